@@ -1,18 +1,17 @@
-#version 410 core
+#version 430 core
 
 #include "Utils.glsl"
 
-uniform float uTime;
-
-uniform mat4 uModelMatrix;
 uniform mat4 uViewProjectionMatrix;
-uniform mat4 uInverseModelMatrix;
-
-uniform mat4 uPrevModelMatrix;
 uniform mat4 uPrevViewProjectionMatrix;
 
+// Last frame's world position, see MotionVectors.vsh
+in vec3 vPrevPosition;
+flat in uint vPrimitive;
+
 
 out vec4 oNormalMotion;
+out uint oVisibility; // primitive index + 1, 0 for background
 
 void initShader();
 
@@ -23,7 +22,7 @@ void main()
     setupInputs();
 
     vec4 thisPosition = uViewProjectionMatrix * vec4(inPosition, 1);
-    vec4 prevPosition = uPrevViewProjectionMatrix * uPrevModelMatrix *  uInverseModelMatrix * vec4(inPosition, 1);
+    vec4 prevPosition = uPrevViewProjectionMatrix * vec4(vPrevPosition, 1);
 
     vec2 prevFragCoord = prevPosition.xy/prevPosition.w; 
     vec2 thisFragCoord = thisPosition.xy/thisPosition.w;
@@ -31,4 +30,6 @@ void main()
     vec3 n = normal();
     oNormalMotion.xy = vec2(atan(n.y,n.x)/M_PI, n.z);
     oNormalMotion.zw = (thisFragCoord-prevFragCoord)*0.5;
+
+    oVisibility = vPrimitive + 1u;
 }
@@ -0,0 +1,16 @@
+// Shared constants for the sort/scan/reduce compute library. Keep in sync
+// with the constants in GpuPrimitives.cpp.
+
+#define RADIX_BITS 4
+#define RADIX_SIZE 16
+#define RADIX_MASK 15
+
+#define SORT_GROUP_SIZE 256
+#define SORT_ITEMS_PER_THREAD 4
+#define SORT_BLOCK_SIZE 1024
+
+#define SCAN_GROUP_SIZE 256
+#define SCAN_BLOCK_SIZE 512
+
+#define REDUCE_GROUP_SIZE 256
+#define REDUCE_BLOCK_SIZE 512
@@ -0,0 +1,27 @@
+// Interleaved tracing: with uInterleave 2 only a checkerboard, with 4 only
+// one pixel of every 2x2 quad is traced per frame. The pattern rotates with
+// uInterleavePhase and Reconstruct.csh fills in the remaining pixels.
+
+uniform int uInterleave;
+uniform int uInterleavePhase;
+
+const ivec2 QUAD_ORDER[4] = ivec2[](ivec2(0, 0), ivec2(1, 1), ivec2(1, 0), ivec2(0, 1));
+
+// Size of the grid of pixels that are traced this frame
+ivec2 traceGridSize(ivec2 imgSize) {
+  if(uInterleave == 2) return ivec2((imgSize.x + 1) / 2, imgSize.y);
+  if(uInterleave == 4) return (imgSize + 1) / 2;
+  return imgSize;
+}
+
+ivec2 tracedPixel(ivec2 gridPos) {
+  if(uInterleave == 2) return ivec2(gridPos.x * 2 + ((gridPos.y + uInterleavePhase) & 1), gridPos.y);
+  if(uInterleave == 4) return gridPos * 2 + QUAD_ORDER[uInterleavePhase & 3];
+  return gridPos;
+}
+
+bool isTracedPixel(ivec2 pixel) {
+  if(uInterleave == 2) return ((pixel.x + pixel.y + uInterleavePhase) & 1) == 0;
+  if(uInterleave == 4) return all(equal(pixel & 1, QUAD_ORDER[uInterleavePhase & 3]));
+  return true;
+}
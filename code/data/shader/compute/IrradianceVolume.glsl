@@ -0,0 +1,47 @@
+// Baked irradiance probes, see IrradianceVolume.hpp. Paths that hit their
+// bounce limit, or any diffuse bounce after the first with
+// uIrradianceVolumeSecondary, end in a lookup instead of more traversal.
+
+uniform bool uIrradianceVolumeEnabled;
+uniform bool uIrradianceVolumeSecondary;
+uniform ivec3 uIrradianceVolumeResolution;
+uniform vec3 uIrradianceVolumeMin;
+uniform vec3 uIrradianceVolumeMax;
+
+layout(std430, binding = 11) readonly buffer IrradianceVolumeBuffer {
+  vec4 irradianceProbes[]; // r, g, b L1 coefficients and validity per probe
+};
+
+// Radiance SH convolved with the clamped cosine and divided by pi, so the
+// result times the diffuse color is the outgoing radiance
+vec3 probeIrradiance(int probe, vec3 n) {
+  vec4 basis = vec4(0.282095, 0.325735 * n.y, 0.325735 * n.z, 0.325735 * n.x);
+  return vec3(dot(irradianceProbes[probe * 4 + 0], basis),
+              dot(irradianceProbes[probe * 4 + 1], basis),
+              dot(irradianceProbes[probe * 4 + 2], basis));
+}
+
+// Trilinear blend of the surrounding probes, skipping the ones baked inside
+// geometry
+vec3 sampleIrradianceVolume(vec3 pos, vec3 n) {
+  ivec3 res = uIrradianceVolumeResolution;
+  vec3 extent = max(uIrradianceVolumeMax - uIrradianceVolumeMin, vec3(1e-4));
+  vec3 gridPos = clamp((pos - uIrradianceVolumeMin) / extent, vec3(0), vec3(1)) * vec3(res - 1);
+  ivec3 base = min(ivec3(floor(gridPos)), res - 2);
+  vec3 f = gridPos - vec3(base);
+
+  vec3 irradiance = vec3(0);
+  float weightSum = 0;
+  for(int i = 0; i < 8; i++) {
+    ivec3 offset = ivec3(i & 1, (i >> 1) & 1, i >> 2);
+    ivec3 cell = base + offset;
+    int probe = cell.x + res.x * (cell.y + res.y * cell.z);
+
+    vec3 w3 = mix(1.0 - f, f, vec3(offset));
+    float w = w3.x * w3.y * w3.z * irradianceProbes[probe * 4 + 3].x;
+    irradiance += probeIrradiance(probe, n) * w;
+    weightSum += w;
+  }
+
+  return weightSum > 1e-4 ? max(irradiance / weightSum, vec3(0)) : vec3(0);
+}
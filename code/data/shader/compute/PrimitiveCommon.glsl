@@ -11,7 +11,8 @@ struct Primitive {
   Vertex c;
   uint matId;
   uint sortCode;
-  vec2 pad_;
+  uint sortCodeHi;
+  uint drawId; // index of the draw call this frame
 };
 
 struct Ray {
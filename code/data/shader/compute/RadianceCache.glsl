@@ -0,0 +1,92 @@
+// World space radiance cache. Entries are addressed by a spatial hash of
+// the quantized position and the dominant normal axis and store the
+// accumulated outgoing radiance of diffuse path vertices in fixed point, so
+// paths from every pixel can add to them with plain atomics.
+
+// Keep in sync with RADIANCE_CACHE_SIZE in RendererSystem.cpp
+const uint RADIANCE_CACHE_SIZE = 1u << 18;
+const uint RADIANCE_CACHE_PROBES = 8;
+const float RADIANCE_CACHE_SCALE = 256.0;
+const float RADIANCE_CACHE_MAX_SAMPLE = 64.0;
+
+// Checksums are odd, so 0 marks a slot that was never used and 2 one whose
+// entry was evicted. Evicted slots keep the probe chains through them intact.
+const uint RADIANCE_CACHE_EMPTY = 0u;
+const uint RADIANCE_CACHE_EVICTED = 2u;
+
+struct RadianceCacheEntry {
+  uint checksum;
+  uint sampleCount;
+  uint lastUsedFrame;
+  uint pad_;
+  uvec4 radiance;
+};
+
+layout(std430, binding = 6) buffer RadianceCacheBuffer {
+  RadianceCacheEntry radianceCache[];
+};
+
+uniform float uRadianceCacheCellSize;
+// 0 when the whole scene is traced, otherwise keys the entries of a render
+// pass that sees only part of it
+uniform uint uRadianceCacheScene;
+
+uint radianceCacheHash(uint seed) {
+  seed = (seed ^ 61) ^ (seed >> 16);
+  seed *= 9;
+  seed = seed ^ (seed >> 4);
+  seed *= 0x27d4eb2d;
+  seed = seed ^ (seed >> 15);
+  return seed;
+}
+
+// Returns the cache slot for the given surface point or -1. With insert set,
+// missing entries claim the first free or evicted slot of the chain with an
+// atomic compare-and-swap, but only once the whole chain was searched for
+// the key, which may sit behind an evicted slot.
+int radianceCacheFind(vec3 pos, vec3 norm, bool insert) {
+  ivec3 cell = ivec3(floor(pos / uRadianceCacheCellSize));
+
+  vec3 absNorm = abs(norm);
+  uint axis = absNorm.x > absNorm.y ? (absNorm.x > absNorm.z ? 0u : 2u) : (absNorm.y > absNorm.z ? 1u : 2u);
+  uint normalBucket = (axis * 2u + (norm[axis] < 0 ? 1u : 0u)) ^ (uRadianceCacheScene << 3);
+
+  uint hash = radianceCacheHash(uint(cell.x) ^ radianceCacheHash(uint(cell.y) ^ radianceCacheHash(uint(cell.z) ^ radianceCacheHash(normalBucket))));
+  uint checksum = (uint(cell.x) * 73856093u ^ uint(cell.y) * 19349663u ^ uint(cell.z) * 83492791u ^ normalBucket * 2654435761u) | 1u;
+
+  for(uint i = 0; i < RADIANCE_CACHE_PROBES; i++) {
+    uint slot = (hash + i) & (RADIANCE_CACHE_SIZE - 1u);
+    uint stored = radianceCache[slot].checksum;
+    if(stored == checksum) return int(slot);
+    if(stored == RADIANCE_CACHE_EMPTY) break;
+  }
+
+  if(!insert) return -1;
+
+  // Every thread inserting the same key walks the chain in the same order,
+  // so they race for the same slot and the losers find the key there
+  for(uint i = 0; i < RADIANCE_CACHE_PROBES; i++) {
+    uint slot = (hash + i) & (RADIANCE_CACHE_SIZE - 1u);
+    uint stored = radianceCache[slot].checksum;
+    if(stored == RADIANCE_CACHE_EMPTY || stored == RADIANCE_CACHE_EVICTED) {
+      stored = atomicCompSwap(radianceCache[slot].checksum, stored, checksum);
+      if(stored == RADIANCE_CACHE_EMPTY || stored == RADIANCE_CACHE_EVICTED) return int(slot);
+    }
+    if(stored == checksum) return int(slot);
+  }
+
+  return -1;
+}
+
+void radianceCacheAdd(int slot, vec3 radiance) {
+  uvec3 fixedPoint = uvec3(clamp(radiance, vec3(0), vec3(RADIANCE_CACHE_MAX_SAMPLE)) * RADIANCE_CACHE_SCALE);
+  atomicAdd(radianceCache[slot].radiance.x, fixedPoint.x);
+  atomicAdd(radianceCache[slot].radiance.y, fixedPoint.y);
+  atomicAdd(radianceCache[slot].radiance.z, fixedPoint.z);
+  atomicAdd(radianceCache[slot].sampleCount, 1u);
+}
+
+vec3 radianceCacheRadiance(int slot) {
+  RadianceCacheEntry entry = radianceCache[slot];
+  return vec3(entry.radiance.xyz) / (RADIANCE_CACHE_SCALE * float(max(entry.sampleCount, 1u)));
+}
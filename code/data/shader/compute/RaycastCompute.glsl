@@ -0,0 +1,848 @@
+// Path tracing kernel. RendererSystem compiles one permutation per set of
+// defines below (see RaycastPermutation), puts the #version in front and
+// expands the includes before compiling it from a string.
+//   TRACE_TIER:        TRACE_TIER_DIRECT: primary hit, one shadow ray and ambient occlusion
+//                      TRACE_TIER_BOUNCES: path tracing capped at two bounces
+//                      TRACE_TIER_FULL: path tracing up to MAX_BOUNCES
+//   MAX_BOUNCES:       path length
+//   SAMPLE_COUNT:      paths per pixel unless adaptive sampling is on
+//   MATERIAL_TEXTURES: 0 if no material of the frame has a texture
+//   BINDLESS_TEXTURES: texture table mode, see TextureTable.glsl
+//   DEPTH_OF_FIELD:    0 for pinhole cameras
+#define TRACE_TIER_DIRECT 0
+#define TRACE_TIER_BOUNCES 1
+#define TRACE_TIER_FULL 2
+
+#ifndef TRACE_TIER
+#define TRACE_TIER TRACE_TIER_FULL
+#endif
+
+#ifndef MAX_BOUNCES
+#define MAX_BOUNCES 4
+#endif
+
+#ifndef SAMPLE_COUNT
+#define SAMPLE_COUNT 1
+#endif
+
+#ifndef MATERIAL_TEXTURES
+#define MATERIAL_TEXTURES 1
+#endif
+
+#ifndef DEPTH_OF_FIELD
+#define DEPTH_OF_FIELD 1
+#endif
+
+const float MAX_DISTANCE = 500;
+const float PI = 3.14159265359;
+
+#include "PrimitiveCommon.glsl"
+#include "Random.glsl"
+#include "RadianceCache.glsl"
+#include "Interleave.glsl"
+#include "SampleAllocation.glsl"
+#include "IrradianceVolume.glsl"
+#include "TextureTable.glsl"
+
+struct Payload {
+  vec4 col;  
+};
+
+uniform vec2 pixelOffset;
+
+// Dynamic resolution: only this sub-rectangle of backBuffer is rendered
+uniform ivec2 uRenderSize;
+uniform ivec2 uPrevRenderSize;
+uniform int primitiveCount;
+uniform int lightCount;
+
+uniform float totalTime;
+uniform uint uSeed;
+uniform uint uFrameIndex;
+
+uniform bool uHybridPrimary;
+uniform usampler2D uSamplerVisibility;
+
+uniform bool uAdaptiveSampling;
+uniform float uSampleBudget;      // average samples per traced pixel
+uniform int uMaxAdaptiveSamples;
+uniform sampler2D uSamplerSampleWeight;
+
+uniform bool uRadianceCacheEnabled;
+uniform float uRadianceCacheUpdateRatio;
+uniform uint uRadianceCacheMinSamples;
+
+layout(rgba32f, binding = 0) writeonly uniform image2D backBuffer;
+
+layout(std430, binding = 1) buffer PrimitiveBuffer { 
+	Primitive primitives[]; 
+};
+
+// Camera and lights are ranges of the per-frame upload ring, the renderer
+// moves their blocks to its own binding points
+layout(std430, binding = 2) buffer CameraBuffer {
+   vec3 pos;
+   float fov;
+   mat4 invProj;
+   mat4 invView;
+   mat4 view;
+   float lensRadius;
+   float focalDistance;
+} cam;
+
+layout(std430, binding = 3) buffer LightBuffer {
+  SphereLight lights[];
+};
+
+// Resident, indexed by material handle
+layout(std430, binding = 4) buffer MaterialBuffer {
+  Material materials[];
+};
+
+layout(std430, binding = 9) readonly buffer PrimitiveRemapBuffer {
+  uint primitiveRemap[];
+};
+
+// Render passes seeing each draw call, one bit per pass. Another upload
+// ring range, indexed by Primitive.drawId
+layout(std430, binding = 13) readonly buffer DrawPassMaskBuffer {
+  uint drawPassMasks[];
+};
+
+uniform uint uPassMask;
+uniform bool uWholeScene; // every draw call is in this pass, skips the lookup
+
+bool inPass(Primitive p) {
+  return uWholeScene || (drawPassMasks[p.drawId] & uPassMask) != 0u;
+}
+
+
+
+// =============================================================================
+// Helper
+vec3 igamma(vec3 color) {
+  return pow(color, vec3(2.2));
+}
+
+vec3 igamma(float r, float g, float b) {
+  return igamma(vec3(r, g, b));
+}
+
+Ray generateRay(vec2 screenPos, vec2 screenSize, inout uint random) {
+  // The rasterized primary hits are only valid for pixel centers
+  vec2 subpixel = uHybridPrimary ? vec2(1) / screenSize :
+                                   uniformVec2(vec2(-1), vec2(1), random) / screenSize;
+
+  vec4 near = cam.invProj * vec4(screenPos * 2 - 1 + subpixel, 0.0, 1);
+  vec4 far  = cam.invProj * vec4(screenPos * 2 - 1 + subpixel, 0.5, 1);
+
+  near /= near.w;
+  far  /= far.w;
+
+  vec3 dir = normalize((far - near).xyz);
+  
+  Ray result;
+  result.pos = vec3(0);
+  result.dir = dir;
+  
+#if DEPTH_OF_FIELD
+  if (cam.focalDistance > 0 && cam.lensRadius > 0) {
+    vec2 lensPos = concentricSampleDisk(random) * cam.lensRadius;
+
+    vec3 pFocus = dir * cam.focalDistance / -dir.z;
+
+    result.pos = vec3(lensPos, 0);
+    result.dir = normalize(pFocus - result.pos);
+  }
+#endif
+  
+  result.pos = (cam.view * vec4(0,0,0, 1)).xyz;
+  result.dir = normalize( (transpose(cam.invView) * vec4(result.dir, 0)).xyz);
+  return result;
+}
+
+vec3 hemisphereSample(float theta, float phi, vec3 n) {
+  float xs = sin(theta) * cos(phi);
+  float ys = cos(theta);
+  float zs = sin(theta) * sin(phi);
+
+  vec3 y = n;
+  vec3 h = y;
+
+  if (abs(h.x) <= abs(h.y) && abs(h.x) <= abs(h.z)) {
+    h.x = 1.0;
+  } else if (abs(h.y) <= abs(h.x) && abs(h.y) <= abs(h.z)) {
+    h.y = 1.0;
+  } else {
+    h.z = 1.0;
+  }
+
+  vec3 x = normalize(cross(h, y));
+  vec3 z = normalize(cross(x, y));
+
+  return normalize(xs * x + ys * y + zs * z);
+}
+
+// =============================================================================
+// Material
+
+bool intersect(in Ray r, float maxDist, out HitInfo hit) {
+  bool didIntersect = false;
+  hit.t = maxDist;
+  for(int i = 0; i < primitiveCount; i++) {
+    Primitive p = primitives[i];
+    if (!inPass(p)) {
+      continue;
+    }
+    
+    HitInfo currHit;
+
+    if(intersectPrimitive(r, p, currHit)) {
+      if(currHit.t < hit.t) {
+        didIntersect = true;
+        hit = currHit;
+      }
+    }
+  }
+  
+  hit.material = materials[hit.matId];
+  return didIntersect;
+}
+
+// Starts the path at the triangle the raster pass saw in this pixel, so no
+// traversal is needed for the primary ray. Only falls back to the full
+// search if the ray misses that triangle, e.g. on silhouettes.
+bool intersectPrimary(in Ray r, uint visibility, out HitInfo hit) {
+  if (visibility == 0u) {
+    hit.t = MAX_DISTANCE;
+    return false;
+  }
+
+  Primitive p = primitives[primitiveRemap[visibility - 1u]];
+  if (intersectPrimitive(r, p, hit)) {
+    hit.material = materials[hit.matId];
+    return true;
+  }
+
+  return intersect(r, MAX_DISTANCE, hit);
+}
+
+// =============================================================================
+// Illumination
+
+vec3 getNormalFromTexture(vec3 tex) {
+  return normalize(tex * 2 - vec3(1));
+}
+
+#if MATERIAL_TEXTURES
+vec3 sampleNormal(HitInfo hit) {
+  Material mat = materials[hit.matId];
+  
+  vec3 tangentspace_normal = mat.normalTexId == NO_TEXTURE ? 
+                             vec3(0, 0, 1) :
+                             getNormalFromTexture(sampleMaterialTexture(mat.normalTexId, hit.uv).xyz);
+
+  
+  vec3 worldNormal = hit.norm;
+  worldNormal.xy += tangentspace_normal.xy;
+  return normalize(worldNormal);
+}
+
+vec3 sampleEmissiveColor(HitInfo hit) {
+  Material mat = materials[hit.matId];
+  vec4 tex = mat.emissiveTexId == NO_TEXTURE ? vec4(1) : sampleMaterialTexture(mat.emissiveTexId, hit.uv);
+  return tex.rgb * tex.a * mat.emissiveColor;
+}
+
+vec3 sampleDiffuseColor(HitInfo hit) {
+  Material mat = materials[hit.matId];
+  vec4 tex = mat.diffuseTexId == NO_TEXTURE ? vec4(1) : sampleMaterialTexture(mat.diffuseTexId, hit.uv);
+  return tex.rgb * mat.diffuseColor;
+}
+#else
+// No texture is bound this frame, every lookup would return the constant
+vec3 sampleNormal(HitInfo hit) {
+  return normalize(hit.norm);
+}
+
+vec3 sampleEmissiveColor(HitInfo hit) {
+  return materials[hit.matId].emissiveColor;
+}
+
+vec3 sampleDiffuseColor(HitInfo hit) {
+  return materials[hit.matId].diffuseColor;
+}
+#endif
+
+// direct illu at a given point
+// inDir points TOWARDS the surface
+vec3 directIllumination(vec3 pos, vec3 inDir, vec3 N, Material material, inout uint random) {
+  HitInfo intr;
+  vec3 color = vec3(0);
+
+  vec3 specularColor = material.specularColor;
+  vec3 diffuseColor = material.diffuseColor * (vec3(1) - specularColor);
+
+  uint lightId = uniformUInt(0, lightCount, random);
+
+  vec3 V = -inDir;
+  vec3 lPos = vec3(0);
+  vec3 lColor = vec3(0);
+
+  if(lightId < lightCount) {
+    SphereLight l = lights[lightId];
+    lPos = l.center + directionUniformSphere(random) * l.radius;
+    lColor = l.color.rgb * l.color.a;
+  } else {
+    lightId -= lightCount;
+
+    Primitive p = primitives[lightId];
+    if (!inPass(p)) {
+      return vec3(0);
+    }
+    Material m = materials[p.matId];
+    lPos = samplePrimitive(p, random);
+    lColor = m.emissiveColor;
+  }
+
+  vec3 L = lPos - pos;
+  float lightDis = length(L);
+  L /= lightDis;
+    
+
+  Ray r;
+  r.pos = pos;
+  r.dir = L;
+
+  if (intersect(r, lightDis, intr)) {
+    return vec3(0);
+  }
+
+  float p = 1.0/(lightDis * lightDis);
+  // diffuse
+  return max(0.0, dot(L, N)) * lColor * p;
+}
+
+// =============================================================================
+// ReSTIR direct illumination
+// Light samples are streamed into per-pixel reservoirs at the primary hit
+// and combined with the reprojected reservoir of the previous frame and a
+// few of its neighbours, so only the final sample needs a shadow ray.
+
+struct Reservoir {
+  vec4 lightPos;      // xyz: point on the light, w: 1 for area lights
+  vec4 lightNormal;   // xyz: normal of the emitting surface
+  vec4 lightRadiance; // rgb: emitted radiance, a: target pdf at the owning surface
+  vec4 surface;       // xyz: shading normal, w: primary hit distance (< 0 for misses)
+  float wSum;
+  float M;
+  float W;
+  float pad_;
+};
+
+const float RESTIR_TEMPORAL_MAX_M = 20.0;
+
+uniform bool uRestirEnabled;
+uniform int uRestirCandidates;
+uniform int uRestirSpatialSamples;
+uniform float uRestirSpatialRadius;
+uniform sampler2D uSamplerNormalMotion;
+
+layout(std430, binding = 7) buffer ReservoirBuffer {
+  Reservoir reservoirs[];
+};
+
+layout(std430, binding = 8) readonly buffer PrevReservoirBuffer {
+  Reservoir prevReservoirs[];
+};
+
+// Reservoirs are laid out for the full target so they stay addressable
+// when the render size changes
+int reservoirIndex(ivec2 pixel) {
+  return pixel.y * imageSize(backBuffer).x + pixel.x;
+}
+
+float luminance(vec3 color) {
+  return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+Reservoir emptyReservoir() {
+  Reservoir r;
+  r.lightPos = vec4(0);
+  r.lightNormal = vec4(0);
+  r.lightRadiance = vec4(0);
+  r.surface = vec4(0, 0, 0, -1);
+  r.wSum = 0;
+  r.M = 0;
+  r.W = 0;
+  r.pad_ = 0;
+  return r;
+}
+
+// Unshadowed contribution of the reservoir's light sample at a surface
+vec3 evaluateLightSample(Reservoir r, vec3 pos, vec3 N) {
+  vec3 L = r.lightPos.xyz - pos;
+  float dist2 = max(dot(L, L), 1e-6);
+  L *= inversesqrt(dist2);
+
+  float cosSurface = max(0.0, dot(N, L));
+  float cosLight = r.lightPos.w > 0 ? abs(dot(r.lightNormal.xyz, L)) : 1.0;
+  return r.lightRadiance.rgb * cosSurface * cosLight / dist2;
+}
+
+// Draws one candidate from the sphere lights or the emissive primitives and
+// returns its source pdf, or 0 if nothing could be sampled.
+float sampleLightCandidate(inout Reservoir candidate, inout uint random) {
+  float sphereProb = lightCount > 0 ? (primitiveCount > 0 ? 0.5 : 1.0) : 0.0;
+
+  if (uniformFloat(0, 1, random) < sphereProb) {
+    SphereLight l = lights[uniformUInt(0, lightCount, random)];
+    candidate.lightPos = vec4(l.center + directionUniformSphere(random) * l.radius, 0);
+    candidate.lightNormal = vec4(0);
+    candidate.lightRadiance = vec4(l.color.rgb * l.color.a, 0);
+    return sphereProb / float(lightCount);
+  }
+
+  if (primitiveCount == 0) {
+    return 0;
+  }
+
+  Primitive p = primitives[uniformUInt(0, primitiveCount, random)];
+  if (!inPass(p)) {
+    return 0;
+  }
+  vec3 emissive = materials[p.matId].emissiveColor;
+  vec3 n = cross(p.b.pos - p.a.pos, p.c.pos - p.a.pos);
+  float area = 0.5 * length(n);
+
+  if (area <= 0 || dot(emissive, emissive) == 0) {
+    return 0;
+  }
+
+  candidate.lightPos = vec4(samplePrimitive(p, random), 1);
+  candidate.lightNormal = vec4(normalize(n), 0);
+  candidate.lightRadiance = vec4(emissive, 0);
+  return (1.0 - sphereProb) / (float(primitiveCount) * area);
+}
+
+void selectSample(inout Reservoir r, Reservoir q, float targetPdf) {
+  r.lightPos = q.lightPos;
+  r.lightNormal = q.lightNormal;
+  r.lightRadiance = vec4(q.lightRadiance.rgb, targetPdf);
+}
+
+void combineReservoir(inout Reservoir r, Reservoir q, vec3 pos, vec3 N, inout uint random) {
+  float targetPdf = luminance(evaluateLightSample(q, pos, N));
+  float w = targetPdf * q.W * q.M;
+
+  r.wSum += w;
+  r.M += q.M;
+  if (uniformFloat(0, 1, random) * r.wSum < w) {
+    selectSample(r, q, targetPdf);
+  }
+}
+
+bool isSimilarSurface(vec4 surface, vec3 N, float dist) {
+  return surface.w > 0 && abs(surface.w - dist) < 0.1 * dist && dot(surface.xyz, N) > 0.9;
+}
+
+vec3 restirDirectIllumination(ivec2 pixel, vec3 pos, vec3 N, float dist, inout uint random) {
+  Reservoir r = emptyReservoir();
+
+  // Initial resampling of fresh candidates
+  for (int i = 0; i < uRestirCandidates; i++) {
+    Reservoir candidate = emptyReservoir();
+    float sourcePdf = sampleLightCandidate(candidate, random);
+    float targetPdf = sourcePdf > 0 ? luminance(evaluateLightSample(candidate, pos, N)) : 0;
+    float w = sourcePdf > 0 ? targetPdf / sourcePdf : 0;
+
+    r.wSum += w;
+    r.M += 1;
+    if (uniformFloat(0, 1, random) * r.wSum < w) {
+      selectSample(r, candidate, targetPdf);
+    }
+  }
+
+  // Temporal and spatial reuse from last frame's reservoirs
+  vec2 uv = (vec2(pixel) + 0.5) / vec2(uRenderSize);
+  vec2 prevUv = uv - texelFetch(uSamplerNormalMotion, pixel, 0).zw;
+
+  for (int i = 0; i <= uRestirSpatialSamples; i++) {
+    vec2 offset = i == 0 ? vec2(0) : concentricSampleDisk(random) * uRestirSpatialRadius;
+    ivec2 prevPixel = ivec2(prevUv * vec2(uPrevRenderSize) + offset);
+
+    if (any(lessThan(prevPixel, ivec2(0))) || any(greaterThanEqual(prevPixel, uPrevRenderSize))) {
+      continue;
+    }
+
+    Reservoir prev = prevReservoirs[reservoirIndex(prevPixel)];
+    if (!isSimilarSurface(prev.surface, N, dist)) {
+      continue;
+    }
+
+    prev.M = min(prev.M, RESTIR_TEMPORAL_MAX_M * float(uRestirCandidates));
+    combineReservoir(r, prev, pos, N, random);
+  }
+
+  float targetPdf = r.lightRadiance.a;
+  r.W = targetPdf > 0 ? r.wSum / (r.M * targetPdf) : 0;
+
+  // Only the surviving sample gets a shadow ray
+  vec3 result = vec3(0);
+  if (r.W > 0) {
+    vec3 L = r.lightPos.xyz - pos;
+    float lightDis = length(L);
+
+    Ray shadowRay;
+    shadowRay.pos = pos;
+    shadowRay.dir = L / lightDis;
+
+    HitInfo shadowHit;
+    if (intersect(shadowRay, lightDis * (1.0 - 1e-3), shadowHit)) {
+      r.W = 0;
+    } else {
+      result = evaluateLightSample(r, pos, N) * r.W;
+    }
+  }
+
+  r.surface = vec4(N, dist);
+  reservoirs[reservoirIndex(pixel)] = r;
+  return result;
+}
+
+float pow5(float val) {
+  return val * val * val * val * val;
+}
+
+float fresnel_schlick(vec3 H, vec3 norm, float n1) {
+  float r0 = n1 * n1;
+  return r0 + (1-r0)*pow5(1 - dot(H, norm));
+}
+
+// =============================================================================
+// tracing
+const int MAX_CACHE_VERTICES = 8;
+
+vec3 trace(Ray r, ivec2 pixel, bool useRestir, uint visibility, inout uint random) {
+  HitInfo intr;
+
+#if TRACE_TIER == TRACE_TIER_BOUNCES
+  const int maxBounces = min(MAX_BOUNCES, 2);
+#else
+  const int maxBounces = MAX_BOUNCES;
+#endif
+  
+  vec3 color = vec3(0);
+  vec3 weight = vec3(1);
+
+  // Training paths never terminate into the radiance cache but feed the
+  // radiance leaving each of their diffuse vertices back into it.
+  bool trainCache = uRadianceCacheEnabled && uniformFloat(0, 1, random) < uRadianceCacheUpdateRatio;
+  bool hadDiffuseBounce = false;
+
+  int cacheVertexCount = 0;
+  int cacheSlots[MAX_CACHE_VERTICES];
+  vec3 cacheColors[MAX_CACHE_VERTICES];
+  vec3 cacheWeights[MAX_CACHE_VERTICES];
+
+  for (int b = 0; b < maxBounces; ++b) {
+    bool didHit = uHybridPrimary && b == 0 ? intersectPrimary(r, visibility, intr) :
+                                             intersect(r, MAX_DISTANCE, intr);
+    if (!didHit) {
+      break;
+    }
+
+    if (uRadianceCacheEnabled && intr.material.refractiveness == 0.0) {
+      if (trainCache) {
+        if (cacheVertexCount < MAX_CACHE_VERTICES) {
+          int slot = radianceCacheFind(intr.pos, intr.norm, true);
+          if (slot >= 0) {
+            cacheSlots[cacheVertexCount] = slot;
+            cacheColors[cacheVertexCount] = color;
+            cacheWeights[cacheVertexCount] = weight;
+            cacheVertexCount++;
+          }
+        }
+      } else if (hadDiffuseBounce) {
+        int slot = radianceCacheFind(intr.pos, intr.norm, false);
+        if (slot >= 0 && radianceCache[slot].sampleCount >= uRadianceCacheMinSamples) {
+          radianceCache[slot].lastUsedFrame = uFrameIndex;
+          color += radianceCacheRadiance(slot) * weight;
+          break;
+        }
+      }
+    }
+
+    vec3 norm = sampleNormal(intr);
+
+    vec3 outDir;
+
+    vec3 emissiveColor = sampleEmissiveColor(intr);
+    vec3 diffuseColor = sampleDiffuseColor(intr);
+    vec3 specularColor = intr.material.specularColor;
+    vec3 refractionColor = intr.material.specularColor;
+    float ior = intr.material.eta;
+    
+    float inside = sign(dot(r.dir, norm)); // 1 for inside, -1 for outside
+    
+    float n1 = inside < 0 ? 1.0 / ior : ior;
+    float n2 = 1.0 / n1;
+
+    float fresnel = fresnel_schlick(-r.dir, -inside*norm, (n1 - n2)/(n1+n2));
+
+    float rhoS = fresnel;
+    float rhoD = (1.0 - fresnel) * (1.0 - intr.material.refractiveness);
+    float rhoR = (1.0 - fresnel) * intr.material.refractiveness;
+    float rhoE = dot(vec3(1.0/3.0), emissiveColor);
+   
+    float totalrho = rhoS + rhoD + rhoR + rhoE;
+    rhoS /= totalrho;
+    rhoD /= totalrho;
+    rhoR /= totalrho;
+    rhoE /= totalrho;
+    
+    float rand = uniformFloat(0, 1, random);
+    bool endInVolume = false;
+
+    // REFLECT diffuse
+    if (rand <= rhoD)
+    {
+      outDir = directionCosTheta(norm, random);
+      weight *= diffuseColor;
+      endInVolume = uIrradianceVolumeEnabled &&
+                    (b == maxBounces - 1 || (uIrradianceVolumeSecondary && hadDiffuseBounce));
+      hadDiffuseBounce = true;
+    }
+    // REFLECT glossy or refract
+    else if(rand <= rhoD + rhoS + rhoR) 
+    {
+      // REFLECT glossy
+      if (rand <= rhoD + rhoS)
+      {
+        outDir = reflect(r.dir, norm);
+        weight *= specularColor;
+      }
+      // REFRACT
+      else
+      {
+        outDir = refract(r.dir, -inside * norm, n1);
+        if(dot(outDir, outDir) < 0.9f ) {
+          // TOTAL INTERNAL REFLECTION
+          outDir = reflect(r.dir, norm);
+          weight *= specularColor;
+        } else {
+          weight *= refractionColor;
+        }
+      }
+
+      if(intr.material.roughness != 0.0)
+      {
+        float n = 1.0f / intr.material.roughness;
+
+        float u1 = uniformFloat(0, 1, random), u2 = uniformFloat(0, 1, random);
+        float theta = acos(pow(u1, 1.0 / (n + 1)));
+        float phi = 2.0 * PI * u2;
+
+        outDir = hemisphereSample(theta, phi, outDir);
+      }
+    } 
+    else 
+    {
+      color += max(dot(norm, -r.dir), 0.0f) * emissiveColor * weight;
+      break;
+    }
+
+    if (useRestir && b == 0) {
+      color += restirDirectIllumination(pixel, intr.pos, norm, intr.t, random) * weight;
+    } else {
+      color += directIllumination(intr.pos, r.dir, norm, intr.material, random) * weight;
+    }
+
+    // The probes hold what the rest of the path would have gathered
+    if (endInVolume) {
+      color += sampleIrradianceVolume(intr.pos, norm) * weight;
+      break;
+    }
+
+    r.pos = intr.pos;
+    r.dir = outDir;
+  }
+
+  // Radiance leaving each recorded vertex is what the path gathered after
+  // it, divided by the throughput that led to it.
+  for (int i = 0; i < cacheVertexCount; i++) {
+    vec3 vertexRadiance = (color - cacheColors[i]) / max(cacheWeights[i], vec3(1e-4));
+    radianceCacheAdd(cacheSlots[i], vertexRadiance);
+    radianceCache[cacheSlots[i]].lastUsedFrame = uFrameIndex;
+  }
+  
+  return color;
+}
+
+#if TRACE_TIER == TRACE_TIER_DIRECT
+uniform int uAmbientOcclusionSamples;
+uniform float uAmbientOcclusionRadius;
+uniform vec3 uAmbientColor;
+
+// Direct light at the primary hit plus an ambient term, either the baked
+// irradiance volume or a constant color, darkened by short occlusion rays
+vec3 traceDirect(Ray r, ivec2 pixel, bool useRestir, uint visibility, inout uint random) {
+  HitInfo intr;
+  bool didHit = uHybridPrimary ? intersectPrimary(r, visibility, intr) :
+                                 intersect(r, MAX_DISTANCE, intr);
+  if (!didHit) {
+    return vec3(0);
+  }
+
+  vec3 norm = sampleNormal(intr);
+  vec3 facingNorm = dot(norm, r.dir) > 0 ? -norm : norm;
+  vec3 diffuseColor = sampleDiffuseColor(intr);
+
+  vec3 color = max(dot(norm, -r.dir), 0.0f) * sampleEmissiveColor(intr);
+
+  if (useRestir) {
+    color += restirDirectIllumination(pixel, intr.pos, norm, intr.t, random) * diffuseColor;
+  } else {
+    color += directIllumination(intr.pos, r.dir, norm, intr.material, random) * diffuseColor;
+  }
+
+  int aoSamples = max(uAmbientOcclusionSamples, 1);
+  float visible = 0;
+  for (int i = 0; i < aoSamples; i++) {
+    Ray aoRay;
+    aoRay.pos = intr.pos;
+    aoRay.dir = directionCosTheta(facingNorm, random);
+
+    HitInfo aoHit;
+    visible += intersect(aoRay, uAmbientOcclusionRadius, aoHit) ? 0.0 : 1.0;
+  }
+
+  vec3 ambient = uIrradianceVolumeEnabled ? sampleIrradianceVolume(intr.pos, facingNorm) : uAmbientColor;
+  color += ambient * diffuseColor * (visible / float(aoSamples));
+  return color;
+}
+#endif
+
+// Every pixel keeps one sample, the rest of the budget is split by the
+// weights of SampleAllocation.csh. Rounding is stochastic so the budget
+// holds on average.
+int adaptiveSampleCount(ivec2 pixel, inout uint random) {
+  float weight = texelFetch(uSamplerSampleWeight, pixel, 0).r;
+  float meanWeight = float(sampleWeightSum) / (SAMPLE_WEIGHT_SCALE * float(max(sampledPixelCount, 1u)));
+  float extra = max(uSampleBudget - 1.0, 0.0) * weight / max(meanWeight, 1e-6);
+  int count = 1 + int(extra + uniformFloat(0, 1, random));
+  return clamp(count, 1, uMaxAdaptiveSamples);
+}
+
+void shadePixel(ivec2 storePos, ivec2 imgSize) {
+  uint random = wang_hash(wang_hash(uint(totalTime * 1003 + storePos.x * 7)) + uint(totalTime * 5000 + storePos.y * 15001));
+/*
+  uint random = wang_hash(uint((sin(storePos.x-imgSize.x/2) + cos(storePos.y+imgSize.y/2) )*totalTime*0.005)) + uint(totalTime*10+storePos.x+storePos.y);
+  */
+
+  Ray r = generateRay(vec2(storePos)/vec2(imgSize), imgSize, random);
+  
+  Payload pl;
+  pl.col = vec4(0, 0, 0, 1);
+  
+  if(uRestirEnabled) {
+    reservoirs[reservoirIndex(storePos)] = emptyReservoir();
+  }
+
+  uint visibility = 0u;
+  if(uHybridPrimary) {
+    visibility = texelFetch(uSamplerVisibility, storePos, 0).r;
+  }
+
+  int sampleCount = uAdaptiveSampling ? adaptiveSampleCount(storePos, random) : SAMPLE_COUNT;
+  for(int i = 0; i < sampleCount; i++) {
+#if TRACE_TIER == TRACE_TIER_DIRECT
+    pl.col.rgb += traceDirect(r, storePos, uRestirEnabled && i == 0, visibility, random);
+#else
+    pl.col.rgb += trace(r, storePos, uRestirEnabled && i == 0, visibility, random);
+#endif
+  }
+  
+  pl.col.rgb *= 1.0/sampleCount;
+  pl.col.rgb = pl.col.rgb;
+  
+  imageStore(backBuffer, storePos, pl.col);
+}
+
+// =============================================================================
+// Persistent threads
+// A fixed number of groups stays resident and pulls work from an atomic
+// counter until the frame is done, so groups whose paths terminate early
+// don't idle while others are still tracing long refractive paths.
+
+const int WORK_ITEM_TILES = 0;
+const int WORK_ITEM_PATHS = 1;
+
+uniform bool uPersistentThreads;
+uniform int uWorkItemMode;
+
+layout(std430, binding = 5) buffer WorkQueueBuffer {
+  uint nextWorkItem;
+};
+
+shared uint sharedWorkItem;
+
+// Work items are handed out tile by tile so that neighbouring lanes still
+// trace neighbouring pixels, even when every lane fetches its own path.
+ivec2 workItemToPixel(uint item, ivec2 tileCount) {
+  uint tile = item / 64;
+  uint inTile = item % 64;
+  return ivec2(tile % tileCount.x, tile / tileCount.x) * 8 + ivec2(inTile % 8, inTile / 8);
+}
+
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+void main() {
+  ivec2 imgSize = uRenderSize;
+  ivec2 traceSize = traceGridSize(imgSize);
+
+  if(!uPersistentThreads) {
+    ivec2 gridPos = ivec2(gl_GlobalInvocationID.xy);
+    if(gridPos.x >= traceSize.x || gridPos.y >= traceSize.y) return;
+
+    ivec2 storePos = tracedPixel(gridPos);
+    if(storePos.x < imgSize.x && storePos.y < imgSize.y) {
+      shadePixel(storePos, imgSize);
+    }
+    return;
+  }
+
+  ivec2 tileCount = (traceSize + ivec2(7)) / 8;
+  uint totalTiles = uint(tileCount.x * tileCount.y);
+
+  if(uWorkItemMode == WORK_ITEM_TILES) {
+    // The whole group works on one 8x8 tile at a time.
+    while(true) {
+      if(gl_LocalInvocationIndex == 0) {
+        sharedWorkItem = atomicAdd(nextWorkItem, 1);
+      }
+      barrier();
+      uint tile = sharedWorkItem;
+      barrier();
+
+      if(tile >= totalTiles) break;
+
+      ivec2 gridPos = workItemToPixel(tile * 64 + gl_LocalInvocationIndex, tileCount);
+      ivec2 storePos = tracedPixel(gridPos);
+      if(all(lessThan(gridPos, traceSize)) && all(lessThan(storePos, imgSize))) {
+        shadePixel(storePos, imgSize);
+      }
+    }
+  } else {
+    // Every lane regenerates a new path as soon as its current one is done.
+    while(true) {
+      uint item = atomicAdd(nextWorkItem, 1);
+      if(item >= totalTiles * 64) break;
+
+      ivec2 gridPos = workItemToPixel(item, tileCount);
+      ivec2 storePos = tracedPixel(gridPos);
+      if(all(lessThan(gridPos, traceSize)) && all(lessThan(storePos, imgSize))) {
+        shadePixel(storePos, imgSize);
+      }
+    }
+  }
+}
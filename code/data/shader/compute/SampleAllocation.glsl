@@ -0,0 +1,12 @@
+// Disocclusion-aware sample allocation: SampleAllocation.csh gives every
+// traced pixel a weight from how much history TXAA could keep for it and
+// sums the weights up. The tracer then spreads a fixed budget of extra
+// samples proportional to the weights, so newly revealed pixels get more
+// samples and converged ones only the base sample.
+
+const float SAMPLE_WEIGHT_SCALE = 256.0;
+
+layout(std430, binding = 10) buffer SampleAllocationBuffer {
+  uint sampleWeightSum;   // fixed point, see SAMPLE_WEIGHT_SCALE
+  uint sampledPixelCount;
+};
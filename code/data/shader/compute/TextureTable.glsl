@@ -0,0 +1,28 @@
+// Material textures by their stable index, see TextureTable.hpp. With
+// BINDLESS_TEXTURES an entry is a resident handle (the renderer enables
+// GL_ARB_bindless_texture ahead of the defines), otherwise it names an
+// array and a layer.
+
+const uint NO_TEXTURE = 0xFFFFFFFFu;
+
+#ifndef BINDLESS_TEXTURES
+#define BINDLESS_TEXTURES 0
+#endif
+
+#if !BINDLESS_TEXTURES
+const int MAX_TEXTURE_ARRAYS = 8;
+uniform sampler2DArray materialTextureArrays[MAX_TEXTURE_ARRAYS];
+#endif
+
+layout(std430, binding = 12) readonly buffer TextureTableBuffer {
+  uvec2 textureEntries[];
+};
+
+vec4 sampleMaterialTexture(uint id, vec2 uv) {
+  uvec2 entry = textureEntries[id];
+#if BINDLESS_TEXTURES
+  return texture(sampler2D(entry), uv);
+#else
+  return texture(materialTextureArrays[entry.x], vec3(uv, float(entry.y)));
+#endif
+}
@@ -0,0 +1,32 @@
+// Shared helpers of the SVGF denoiser passes.
+
+const float PI = 3.14159265359;
+
+uniform float uNear;
+uniform float uFar;
+
+// Dynamic resolution: only this sub-rectangle of the textures is in use
+uniform ivec2 uRenderSize;
+uniform ivec2 uPrevRenderSize;
+
+// Inverse of the spherical encoding written by MotionVectors.fsh
+vec3 decodeNormal(vec2 enc) {
+  float phi = enc.x * PI;
+  float r = sqrt(max(0.0, 1.0 - enc.y * enc.y));
+  return vec3(r * cos(phi), r * sin(phi), enc.y);
+}
+
+float linearizeDepth(float depth) {
+  float z = depth * 2.0 - 1.0;
+  return 2.0 * uNear * uFar / (uFar + uNear - z * (uFar - uNear));
+}
+
+float luminance(vec3 color) {
+  return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// Rejects history samples and filter taps from a different surface
+bool isConsistent(vec4 normalDepth, vec3 normal, float depth) {
+  return abs(normalDepth.z - depth) < 0.1 * depth &&
+         dot(decodeNormal(normalDepth.xy), normal) > 0.9;
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <engine/graphics/PostFX.hpp>
+#include <glm/glm.hpp>
 #include <array>
 
 class BloomPostFX : public PostFX {
@@ -9,21 +10,16 @@ private:
   glow::SharedProgram m_extractProgram;
   glow::SharedProgram m_blurProgram;
 
-  glow::SharedFramebuffer m_extractBuffer;
-  glow::SharedFramebuffer m_blurBufferHorizontal;
-  glow::SharedFramebuffer m_blurBufferVertical;
-
-  glow::SharedTexture2D m_extractTexture;
-  glow::SharedTexture2D m_blurTextureHorizontal;
-  glow::SharedTexture2D m_blurTextureVertical;
-
   std::array<float, 15> m_gaussianWeights;
   std::array<float, 15> m_sampleOffsets;
 
+  void blur(glow::SharedTexture2D source, glow::SharedFramebuffer target, glm::vec2 direction, float scale);
+
 public:
   BloomPostFX(RendererSystem* renderer, EventSystem* events, QualitySetting quality) : PostFX(renderer, events, quality) { };
 
   void startup() override;
-  void apply(glow::SharedTexture2D inputBuffer, glow::SharedFramebuffer outputBuffer) override;
+  // The extract and blur targets are half size transients
+  void declare(RenderGraph& graph, RenderGraphTexture input, RenderGraphTexture output) override;
   void shutdown() override;
 };
\ No newline at end of file
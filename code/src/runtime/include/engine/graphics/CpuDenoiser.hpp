@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#undef near
+#undef far
+
+// Auxiliary buffers of a rendered frame. All of them are width * height
+// pixels, row-major and interleaved. Guides that are null are not used for
+// edge stopping.
+struct DenoiseInput {
+  int width;
+  int height;
+  const float* color;  // rgb radiance
+  const float* albedo; // rgb, the filter runs on color / albedo if given
+  const float* normal; // xyz in [-1, 1]
+  const float* depth;  // linear depth
+};
+
+struct DenoiseSettings {
+  int iterations = 5;
+  float phiColor = 0.5f;
+  float phiNormal = 0.1f;
+  float phiDepth = 0.5f;
+  int tileSize = 64;
+  int threadCount = 0; // 0: one per hardware thread
+  bool allowSimd = true;
+};
+
+// Edge-avoiding a-trous wavelet filter for offline renders without a GPU.
+// The inner loop runs eight pixels at a time with AVX2 if the CPU supports
+// it and the image is split into tiles that are filtered in parallel.
+class CpuDenoiser {
+public:
+  static bool hasAVX2();
+
+  // Writes width * height rgb pixels to output
+  static void denoise(const DenoiseInput& input, float* output,
+                      const DenoiseSettings& settings = DenoiseSettings());
+
+  // Loads the buffers with stb_image and writes the result as .hdr, or as
+  // an 8 bit sRGB .png for any other extension. Empty guide paths are
+  // skipped.
+  static bool denoiseFiles(const std::string& colorPath, const std::string& albedoPath,
+                           const std::string& normalPath, const std::string& depthPath,
+                           const std::string& outputPath,
+                           const DenoiseSettings& settings = DenoiseSettings());
+};
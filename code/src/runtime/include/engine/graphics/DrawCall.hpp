@@ -10,8 +10,10 @@ struct TransformData {
 };
 
 struct DrawCall {
-  Material material;
+  MaterialHandle material;
   Geometry geometry;
   glm::mat4 lastRenderTransform;
   glm::mat4 thisRenderTransform;
+  uint64_t id; // Stable across frames, the renderer keeps primitives resident per id
+  uint32_t renderPassMask; // bit i: seen by render pass i
 };
\ No newline at end of file
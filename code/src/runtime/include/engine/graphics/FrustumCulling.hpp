@@ -0,0 +1,29 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// World space bounding boxes, one component per array so the frustum test
+// can load eight boxes at a time
+struct CullingBoxes {
+  std::vector<float> minX, minY, minZ;
+  std::vector<float> maxX, maxY, maxZ;
+
+  void clear();
+  // Transforms an object space box, boxes with min > max are never culled
+  void push(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& transform);
+
+  inline size_t size() const { return minX.size(); }
+};
+
+// Tests boxes against the planes of a view projection matrix. Runs on eight
+// boxes at a time with AVX if the CPU supports it.
+class FrustumCulling {
+public:
+  static bool hasAVX();
+
+  // visible[i] is 1 if box i intersects the frustum
+  static void cull(const glm::mat4& viewProjection, const CullingBoxes& boxes,
+                   std::vector<uint8_t>& visible, bool allowSimd = true);
+};
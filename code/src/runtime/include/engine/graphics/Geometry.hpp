@@ -1,6 +1,17 @@
 #pragma once
 #include <glow/fwd.hh>
+#include <glm/glm.hpp>
 
 struct Geometry {
 	glow::SharedVertexArray vao;
-};
\ No newline at end of file
+
+	// Object space bounds of the positions. Geometry without bounds is
+	// never culled.
+	glm::vec3 boundsMin = glm::vec3(1);
+	glm::vec3 boundsMax = glm::vec3(-1);
+
+	inline bool hasBounds() const { return boundsMin.x <= boundsMax.x; }
+
+	// Reads the positions back once to compute the bounds
+	static Geometry create(glow::SharedVertexArray vao);
+};
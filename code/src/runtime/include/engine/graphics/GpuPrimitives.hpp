@@ -0,0 +1,74 @@
+#pragma once
+#include <glow/fwd.hh>
+#include <glow/gl.hh>
+
+#include <string>
+#include <vector>
+
+// Scratch storage that only ever grows, so steady-state frames don't
+// reallocate.
+struct GpuScratchBuffer {
+  glow::SharedShaderStorageBuffer buffer;
+  size_t size = 0;
+
+  void ensureSize(size_t bytes);
+};
+
+// Reusable data-parallel building blocks on top of compute shaders:
+// 4 bit LSD radix key/value sort, exclusive scan, stream compaction and
+// min/max reduction. All operations work on std430 SSBOs that stay on the
+// GPU; nothing is read back unless verify() or benchmark() is called.
+class GpuPrimitives {
+private:
+  glow::SharedProgram m_radixCountProgram;
+  glow::SharedProgram m_radixScatterProgram;
+  glow::SharedProgram m_scanProgram;
+  glow::SharedProgram m_scanAddProgram;
+  glow::SharedProgram m_compactProgram;
+  glow::SharedProgram m_reduceMinMaxProgram;
+
+  GpuScratchBuffer m_sortKeys;
+  GpuScratchBuffer m_sortValues;
+  GpuScratchBuffer m_histograms;
+  std::vector<GpuScratchBuffer> m_scanBlockSums;
+  GpuScratchBuffer m_compactOffsets;
+  GpuScratchBuffer m_reduceScratch[2];
+
+  std::string m_lastVerifyResult;
+  std::string m_lastBenchmarkResult;
+
+  void scanLevel(GLuint data, uint32_t count, size_t level);
+
+public:
+  void startup();
+
+  // Sorts `count` (key, value) pairs by key. Only the lowest `keyBits` bits
+  // of the keys are considered; the sort is stable.
+  void sortKeyValue(glow::SharedShaderStorageBuffer keys,
+                    glow::SharedShaderStorageBuffer values, uint32_t count,
+                    uint32_t keyBits = 32);
+
+  // In-place exclusive prefix sum over `count` uints.
+  void exclusiveScan(glow::SharedShaderStorageBuffer data, uint32_t count);
+
+  // Writes all values whose flag is non-zero to `output` (order preserving)
+  // and their number to the first uint of `outputCount`.
+  void compact(glow::SharedShaderStorageBuffer values,
+               glow::SharedShaderStorageBuffer flags, uint32_t count,
+               glow::SharedShaderStorageBuffer output,
+               glow::SharedShaderStorageBuffer outputCount);
+
+  // Component-wise min and max over `count` vec4s, written as two vec4s
+  // (min, max) to `result`.
+  void reduceMinMax(glow::SharedShaderStorageBuffer data, uint32_t count,
+                    glow::SharedShaderStorageBuffer result);
+
+  // Runs every operation on random data and compares against a CPU
+  // reference implementation.
+  bool verify(uint32_t count);
+
+  // Measures GPU throughput of every operation with timer queries.
+  void benchmark(uint32_t count, int iterations = 10);
+
+  void drawUI();
+};
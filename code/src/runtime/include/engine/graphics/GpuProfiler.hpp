@@ -0,0 +1,111 @@
+#pragma once
+#include <glow/gl.hh>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Named GPU scopes measured with GL_TIMESTAMP queries. Every frame in
+// flight has its own query pool, results are read FRAMES_IN_FLIGHT frames
+// later and only if the GPU has them ready, so reading never stalls. Scopes
+// nest; a stage is identified by its path ("Frame/Pass 0/Trace") and
+// scopes with the same path within a frame are added up.
+class GpuProfiler {
+public:
+  static const int FRAMES_IN_FLIGHT = 3;
+  static const int HISTORY_LENGTH = 256;
+
+  struct Statistics {
+    float last = 0;
+    float min = 0;
+    float avg = 0;
+    float p99 = 0;
+    size_t samples = 0;
+  };
+
+private:
+  struct Stage {
+    std::string path;
+    std::string name;
+    int depth;
+    std::vector<float> history; // ring of the last HISTORY_LENGTH frames in ms
+    size_t next;
+    size_t count;
+    float last;
+  };
+
+  struct Scope {
+    size_t stage;
+    size_t beginQuery;
+    size_t endQuery;
+  };
+
+  // A scope that was begun but not ended yet, stage is NO_STAGE for scopes
+  // begun outside of a frame
+  struct OpenScope {
+    size_t stage;
+    size_t scope; // index into the frame's scopes
+  };
+
+  struct Frame {
+    std::vector<GLuint> queries;
+    size_t usedQueries = 0;
+    std::vector<Scope> scopes;
+    bool pending = false;
+  };
+
+  Frame m_frames[FRAMES_IN_FLIGHT];
+  int m_frame = 0;
+  bool m_inFrame = false;
+  bool m_created = false; // queries are only issued after create()
+
+  std::vector<Stage> m_stages;
+  std::unordered_map<std::string, size_t> m_stageIds;
+  std::vector<OpenScope> m_openScopes;
+
+  size_t m_droppedFrames = 0;
+
+  size_t stageFor(const std::string& name);
+  size_t timestamp();
+  bool resolve(Frame& frame);
+
+public:
+  // Until create() scopes only make up the stages, no queries are issued
+  void create();
+  void destroy();
+
+  // Reads back the frame that used this pool last, returns true if it had
+  // results
+  bool beginFrame();
+  void endFrame();
+
+  void begin(const std::string& name);
+  void end();
+
+  // Last resolved time of a stage, false if it was never measured
+  bool lastTime(const std::string& path, float& ms) const;
+  Statistics statistics(size_t stage) const;
+
+  inline size_t stageCount() const { return m_stages.size(); }
+  inline const std::string& stagePath(size_t stage) const { return m_stages[stage].path; }
+  inline size_t droppedFrames() const { return m_droppedFrames; }
+
+  void drawUI();
+
+  bool exportCSV(const std::string& path) const;
+  bool exportJSON(const std::string& path) const;
+};
+
+// Begins a scope that ends with the enclosing block
+class GpuProfilerScope {
+  GpuProfiler& m_profiler;
+
+public:
+  GpuProfilerScope(GpuProfiler& profiler, const std::string& name) : m_profiler(profiler) {
+    m_profiler.begin(name);
+  }
+  ~GpuProfilerScope() { m_profiler.end(); }
+
+  GpuProfilerScope(const GpuProfilerScope&) = delete;
+  GpuProfilerScope& operator=(const GpuProfilerScope&) = delete;
+};
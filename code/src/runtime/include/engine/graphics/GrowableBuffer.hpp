@@ -0,0 +1,48 @@
+#pragma once
+#include <glow/fwd.hh>
+#include <glow/gl.hh>
+
+#include <vector>
+
+// Storage buffer holding an array whose capacity grows geometrically with
+// the element count. Frames that don't need more room never reallocate.
+// The contents are undefined after the buffer grew, data that is kept
+// resident has to be written again.
+class GrowableBuffer {
+private:
+  glow::SharedShaderStorageBuffer m_buffer;
+  size_t m_elementSize = 1;
+  size_t m_capacity = 0;
+  size_t m_count = 0;
+  size_t m_maxCount = 0;
+  size_t m_reallocations = 0;
+
+public:
+  // Creates the GL buffer, needs a current context
+  void create(size_t elementSize, size_t initialCapacity);
+
+  // Makes room for `count` elements and sets the occupancy. Returns true if
+  // the storage was reallocated. Counts above maxCount() are clamped.
+  bool resize(size_t count);
+
+  // Resizes to data.size() and uploads it without reallocating the storage
+  template <typename T>
+  bool setData(const std::vector<T>& data) {
+    bool reallocated = resize(data.size());
+    upload(data.data(), data.size() * sizeof(T));
+    return reallocated;
+  }
+
+  // Largest array a single shader storage block may hold on this device
+  inline size_t maxCount() const { return m_maxCount; }
+
+  inline const glow::SharedShaderStorageBuffer& buffer() const { return m_buffer; }
+  inline size_t count() const { return m_count; }
+  inline size_t capacity() const { return m_capacity; }
+  inline size_t reallocations() const { return m_reallocations; }
+  inline size_t bytesUsed() const { return m_count * m_elementSize; }
+  inline size_t bytesAllocated() const { return m_capacity * m_elementSize; }
+
+private:
+  void upload(const void* data, size_t bytes);
+};
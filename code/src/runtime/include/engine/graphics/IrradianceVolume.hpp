@@ -0,0 +1,60 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+// World space scene description for the bake. Materials are reduced to
+// their constant colors, textures are not sampled.
+struct BakeTriangle {
+  glm::vec3 a;
+  glm::vec3 b;
+  glm::vec3 c;
+  uint32_t material;
+};
+
+struct BakeMaterial {
+  glm::vec3 diffuseColor;
+  glm::vec3 emissiveColor;
+};
+
+struct BakeLight {
+  glm::vec3 pos;
+  float radius;
+  glm::vec3 radiance; // color * intensity, like SphereLight in the tracer
+};
+
+struct IrradianceBakeSettings {
+  float probeSpacing = 1.0f;
+  int maxProbesPerAxis = 32;
+  int raysPerProbe = 256;
+  int bounces = 2;
+  int threadCount = 0; // 0: one per hardware thread
+};
+
+// Grid of irradiance probes over the static scene, baked on the CPU. Every
+// probe stores the incoming radiance as L1 spherical harmonics, four vec4s
+// per probe: the r, g and b coefficients (L00, L1-1, L10, L11) and a
+// validity in x of the last one that is 0 for probes inside geometry.
+class IrradianceVolume {
+public:
+  static const int VEC4S_PER_PROBE = 4;
+
+  glm::ivec3 resolution = glm::ivec3(0);
+  glm::vec3 boundsMin = glm::vec3(0);
+  glm::vec3 boundsMax = glm::vec3(0);
+  std::vector<glm::vec4> probes;
+
+  inline bool empty() const { return probes.empty(); }
+  inline size_t probeCount() const { return (size_t)resolution.x * resolution.y * resolution.z; }
+
+  static IrradianceVolume bake(const std::vector<BakeTriangle>& triangles,
+                               const std::vector<BakeMaterial>& materials,
+                               const std::vector<BakeLight>& lights,
+                               const IrradianceBakeSettings& settings = IrradianceBakeSettings());
+
+  // Half float coefficients behind a small header
+  bool save(const std::string& path) const;
+  bool load(const std::string& path);
+};
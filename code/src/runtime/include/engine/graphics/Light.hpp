@@ -9,14 +9,14 @@ enum class LightType {
 struct Light : Component<Light> {
     Light(glm::vec4 color, float size, glm::vec3 dir = glm::vec3(0),
         bool castShadow = true, LightType type = LightType::POINT,
-        uint32_t renderPassIndex = 0)
+        uint32_t renderPassMask = ~0u)
       : color(color), size(size), dir(dir), castShadow(castShadow), type(type),
-        renderPassIndex(renderPassIndex) {}
+        renderPassMask(renderPassMask) {}
 
   glm::vec4 color;
   float size;
   glm::vec3 dir;
   bool castShadow;
   LightType type;
-  uint32_t renderPassIndex;
+  uint32_t renderPassMask; // bit i: lights render pass i, every pass by default
 };
\ No newline at end of file
@@ -1,6 +1,9 @@
 #pragma once
 #include <glow/fwd.hh>
 
+// Index of a material in the renderer's MaterialRegistry
+typedef uint32_t MaterialHandle;
+
 struct Material {
   glm::vec3 diffuseColor;
   float roughness;
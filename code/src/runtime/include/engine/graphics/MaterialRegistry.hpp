@@ -0,0 +1,42 @@
+#pragma once
+#include <engine/graphics/Material.hpp>
+#include <engine/graphics/GrowableBuffer.hpp>
+
+#include <vector>
+
+class TextureTable;
+
+// Materials are added once and live under a stable handle. The registry
+// keeps the GPU copy resident and only writes entries that were changed
+// since the last update.
+class MaterialRegistry {
+private:
+  std::vector<Material> m_materials;
+  // Materials changed since the last update lie in [begin, end)
+  size_t m_dirtyBegin = 0;
+  size_t m_dirtyEnd = 0;
+  size_t m_texturedCount = 0;
+  std::vector<bool> m_textured;
+  GrowableBuffer m_buffer;
+
+  void markDirty(MaterialHandle handle);
+
+public:
+  // Creates the GL buffer, needs a current context
+  void create();
+
+  MaterialHandle add(const Material& material);
+
+  inline const Material& get(MaterialHandle handle) const { return m_materials[handle]; }
+
+  // The returned material may be modified until the next update
+  Material& edit(MaterialHandle handle);
+  void set(MaterialHandle handle, const Material& material);
+
+  // Writes the changed range to the GPU, resolving texture indices
+  void update(TextureTable& textures);
+
+  inline size_t size() const { return m_materials.size(); }
+  inline bool hasTextures() const { return m_texturedCount > 0; }
+  inline const glow::SharedShaderStorageBuffer& buffer() const { return m_buffer.buffer(); }
+};
@@ -16,6 +16,8 @@ struct ScreenSpaceTexture {
 
 class RendererSystem;
 class EventSystem;
+class RenderGraph;
+typedef int RenderGraphTexture;
 
 class PostFX {
 protected:
@@ -29,6 +31,14 @@ public:
 
   PostFX(RendererSystem* renderer, EventSystem* events, QualitySetting quality) : m_renderer(renderer), m_events(events), m_quality(quality) {};
   virtual void startup() = 0;
-  virtual void apply(glow::SharedTexture2D inputBuffer, glow::SharedFramebuffer outputBuffer) = 0;
+  virtual void apply(glow::SharedTexture2D inputBuffer, glow::SharedFramebuffer outputBuffer) {}
   virtual void shutdown() = 0;
+
+  // Names the pass of the default declare, for profiling
+  virtual const char* name() const { return "PostFX"; }
+
+  // Adds the passes of the effect to the frame's render graph. By default
+  // apply runs as one pass, effects with intermediate targets declare them
+  // as transients instead of keeping their own.
+  virtual void declare(RenderGraph& graph, RenderGraphTexture input, RenderGraphTexture output);
 };
\ No newline at end of file
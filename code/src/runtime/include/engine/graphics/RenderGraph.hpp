@@ -0,0 +1,129 @@
+#pragma once
+#include <engine/graphics/PostFX.hpp>
+
+#include <glow/fwd.hh>
+#include <glow/gl.hh>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+class RendererSystem;
+class GpuProfiler;
+
+// Index of a texture declared in the current graph, -1 for none
+typedef int RenderGraphTexture;
+
+// How a pass touches a texture. Only image stores are incoherent in GL,
+// everything written through a framebuffer or a copy is visible to the
+// next command without a barrier.
+enum class RenderGraphAccess {
+  Sampled,
+  Image,
+  RenderTarget,
+  Copy
+};
+
+struct RenderGraphUse {
+  RenderGraphTexture texture;
+  RenderGraphAccess access;
+};
+
+// Screen space passes that declare which textures they read and write.
+// Transient textures only exist from the first to the last pass using
+// them, compile() places them into a pool of textures shared with every
+// transient of the same size and format whose lifetime doesn't overlap,
+// and derives the glMemoryBarrier each pass needs from the accesses.
+// Imported textures are persistent and only take part in the barriers.
+//
+// The pool outlives the graph, so graphs built one after another within a
+// frame share it. The contents of a transient are undefined until a pass
+// of the current graph writes it.
+class RenderGraph {
+public:
+  typedef std::function<void(RenderGraph&)> Execute;
+
+private:
+  struct PooledTexture {
+    ScreenSpaceSize size;
+    GLenum format;
+    glow::SharedTexture2D texture;
+    glow::SharedFramebuffer framebuffer; // created on first use
+    int lastPass; // last pass of the current graph using it, -1 if free
+    bool imported; // never handed out to transients
+
+    // Image stores to the texture that haven't been made visible to every
+    // kind of access yet
+    bool incoherent;
+    GLbitfield barriersIssued;
+  };
+
+  struct Texture {
+    std::string name;
+    ScreenSpaceSize size;
+    GLenum format;
+    int pooled; // index into m_pool once compiled
+    int firstPass;
+    int lastPass;
+    bool imported;
+  };
+
+  struct Pass {
+    std::string name;
+    std::vector<RenderGraphUse> reads;
+    std::vector<RenderGraphUse> writes;
+    Execute execute;
+    GLbitfield barriers;
+  };
+
+  RendererSystem* m_renderer = nullptr;
+  GpuProfiler* m_profiler = nullptr; // scopes every pass if set
+
+  std::vector<PooledTexture> m_pool;
+  std::vector<Texture> m_textures;
+  std::vector<Pass> m_passes;
+  bool m_compiled = false;
+
+  // Counted over all graphs of a frame, the last frame's totals are kept
+  struct Statistics {
+    size_t transientCount = 0;
+    size_t transientBytes = 0;
+    size_t barrierCount = 0;
+  };
+  Statistics m_frameStatistics;
+  Statistics m_lastFrameStatistics;
+
+  int findPooled(const glow::SharedTexture2D& texture) const;
+  int acquirePooled(ScreenSpaceSize size, GLenum format, int pass);
+  GLbitfield visibilityBarrier(PooledTexture& pooled, RenderGraphAccess access);
+
+public:
+  void create(RendererSystem* renderer, GpuProfiler* profiler = nullptr);
+
+  // Drops the passes and textures of the last graph, the pool is kept
+  void reset();
+
+  RenderGraphTexture createTexture(const std::string& name, ScreenSpaceSize size, GLenum format);
+  RenderGraphTexture importTexture(const std::string& name, glow::SharedTexture2D texture);
+
+  void addPass(const std::string& name, std::vector<RenderGraphUse> reads,
+               std::vector<RenderGraphUse> writes, Execute execute);
+
+  // Assigns pooled textures and barriers, called by execute() if needed
+  void compile();
+  void execute();
+
+  // Only valid while the graph executes, or after compile()
+  glow::SharedTexture2D getTexture(RenderGraphTexture texture) const;
+  // Single "oColor" attachment, for transient textures
+  glow::SharedFramebuffer getFramebuffer(RenderGraphTexture texture);
+
+  void endFrame();
+
+  // Transient textures declared last frame against the pool they share
+  inline size_t transientCount() const { return m_lastFrameStatistics.transientCount; }
+  inline size_t transientBytes() const { return m_lastFrameStatistics.transientBytes; }
+  inline size_t barrierCount() const { return m_lastFrameStatistics.barrierCount; }
+  size_t poolSize() const;
+  size_t poolBytes() const;
+};
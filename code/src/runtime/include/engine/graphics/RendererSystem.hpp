@@ -13,11 +13,26 @@
 #include <glow/gl.hh>
 #include <glow/objects/Texture2D.hh>
 #include <glow/objects/Framebuffer.hh>
+#include <glow/objects/Program.hh>
+#include <glow/common/log.hh>
 
 #include <engine/graphics/Light.hpp>
 #include <engine/graphics/PostFX.hpp>
+#include <engine/graphics/SVGFPostFX.hpp>
+#include <engine/graphics/GpuPrimitives.hpp>
+#include <engine/graphics/GrowableBuffer.hpp>
+#include <engine/graphics/UploadRing.hpp>
+#include <engine/graphics/TextureTable.hpp>
+#include <engine/graphics/MaterialRegistry.hpp>
+#include <engine/graphics/RenderGraph.hpp>
+#include <engine/graphics/GpuProfiler.hpp>
+#include <engine/graphics/FrustumCulling.hpp>
+#include <engine/graphics/IrradianceVolume.hpp>
 #include <engine/graphics/RenderQueue.hpp>
 
+#include <functional>
+#include <map>
+
 #undef OPAQUE
 #undef TRANSPARENT
 using namespace glow;
@@ -31,12 +46,25 @@ struct LightData {
   TransformData lastSimulateTransform;
   TransformData thisSimulateTransform;
   glm::mat4 projMatrix;
+  uint32_t renderPassMask; // bit i: lights render pass i
+};
+
+// Compile time settings of a tracing kernel, see the defines at the top of
+// RaycastCompute.glsl
+struct RaycastPermutation {
+  int traceTier;
+  int maxBounces;
+  int sampleCount;
+  bool materialTextures;
+  bool depthOfField;
+  bool bindlessTextures;
+
+  std::string defines() const;
 };
 
+// A camera's view of the scene. The draw calls and lights are submitted
+// once per frame and shared by all passes.
 struct RenderPass {
-  Stack<DrawCall> submittedDrawCallsOpaque;
-  Stack<DrawCall> submittedDrawCallsTransparent;
-  Stack<LightData> submittedLights;
   glow::SharedFramebuffer compositingTarget;
   glow::SharedFramebuffer txaaHistory;
   glow::SharedFramebuffer prevDepthBuffer;
@@ -45,6 +73,23 @@ struct RenderPass {
   bool active;
   bool renderToTextureOnly;
   bool hasSSAO;
+
+  // ReSTIR reservoirs of this and the previous frame, created on first use
+  glow::SharedShaderStorageBuffer reservoirs;
+  glow::SharedShaderStorageBuffer prevReservoirs;
+  size_t reservoirCount;
+
+  SVGFHistory svgfHistory;
+
+  // Reconstructed color of the last frame for interleaved tracing
+  glow::SharedTexture2D interleaveHistory;
+
+  // Part of the screen space targets rendered last frame
+  glm::ivec2 lastRenderSize;
+
+  // The lights in this pass' mask, uploaded by prepareScene
+  UploadRing::Allocation lights;
+  size_t lightCount;
 };
 
 class RendererSystem : public System {
@@ -52,8 +97,17 @@ private:
   const ScreenSpaceSize G_BUFFER_SIZE[3] = {
       ScreenSpaceSize::QUARTER, ScreenSpaceSize::HALF, ScreenSpaceSize::FULL};
 
-  const size_t MAX_PRIMITIVE_COUNT = 32768;
-  const size_t MAX_LIGHT_COUNT = 256;
+  // Starting capacities, the buffers grow with the scene
+  const size_t INITIAL_PRIMITIVE_CAPACITY = 32768;
+  const size_t UPLOAD_RING_REGION_SIZE = 256 * 1024;
+  // The storage blocks the tracer declares use bindings up to 13, see
+  // RaycastCompute.glsl. Upload ring ranges are bound right above them.
+  const GLuint RAYCAST_STORAGE_BINDINGS = 14;
+  const GLuint UPLOAD_RING_BINDING_COUNT = 3;
+
+  // Draw calls and lights carry a bit per pass, see DrawCall::renderPassMask
+  static const size_t MAX_RENDER_PASSES = 32;
+  GLuint m_uploadRingBinding = 0;
 
   SettingsSystem *m_settings;
   EventSystem *m_events;
@@ -67,40 +121,198 @@ private:
 
   uint32_t m_totalLightCount;
 
+  Stack<DrawCall> m_submittedDrawCalls = Stack<DrawCall>(kilobytes(4));
+  Stack<LightData> m_submittedLights = Stack<LightData>(kilobytes(4));
+
+  // Written by prepareScene, read by every pass of the frame
+  size_t m_scenePrimitiveCount = 0;
+  UploadRing::Allocation m_drawTransformAllocation;
+  UploadRing::Allocation m_lightAllocation;
+  // Pass mask of every draw call, indexed like the draw transforms
+  UploadRing::Allocation m_drawPassMaskAllocation;
+  // Passes that see every draw call or every light, they skip the masks
+  uint32_t m_passesWithAllDrawCalls = ~0u;
+  uint32_t m_passesWithAllLights = ~0u;
+
   std::vector<std::shared_ptr<PostFX>> m_effects;
 
   std::vector<ScreenSpaceTexture> m_screenSpaceTextures;
 
   std::vector<SharedTexture2D> m_registeredTextures;
+  TextureTable m_textureTable;
+  MaterialRegistry m_materials;
 
 
   SharedTexture2D m_normalMotionBuffer;
   SharedTexture2D m_depthBuffer;
+  SharedTexture2D m_visibilityBuffer;
   
   glow::SharedFramebuffer m_gBufferObject;
   
+  // Every render pass composites into this, post effects read it
   glow::SharedFramebuffer m_primaryCompositingBuffer;
-  glow::SharedFramebuffer m_secondaryCompositingBuffer;
-  glow::SharedFramebuffer m_postfxTargetBuffer;
+
+  // The tracer output, sample weights and post effect targets are
+  // transients of a graph per render pass and one for post effects
+  RenderGraph m_renderGraph;
+
+  // Timestamps around every stage, render graph passes are scoped by the graph
+  GpuProfiler m_gpuProfiler;
 
   SharedProgram m_blitProgram;
   SharedProgram m_passBlitProgram;
 
+  // Tracing kernels are compiled on first use of their permutation and
+  // cached by their defines. m_raycastComputeProgram is the kernel picked
+  // for the current frame.
+  std::unordered_map<std::string, SharedProgram> m_raycastPermutations;
   SharedProgram m_raycastComputeProgram;
+  int m_traceTier = 0;
+  int m_maxBounces = 4;
+  int m_sampleCount = 1;
+
+  // Uniforms and buffers shared by all permutations, replayed onto new ones
+  std::map<std::string, std::function<void(const SharedProgram&)>> m_raycastState;
+
+  SharedProgram getRaycastProgram(const RaycastPermutation& permutation);
+  void setRaycastStorageBuffer(const std::string& name, SharedShaderStorageBuffer buffer);
+
+  template <typename T>
+  void setRaycastUniform(const std::string& name, const T& value) {
+    auto apply = [name, value](const SharedProgram& program) {
+      auto usedProgram = program->use();
+      usedProgram.setUniform(name, value);
+    };
+
+    for (auto& permutation : m_raycastPermutations) {
+      apply(permutation.second);
+    }
+    m_raycastState["uniform " + name] = apply;
+  }
   SharedProgram m_copyPrimitiveProgram;
-  SharedProgram m_sortPrimitiveProgram;
-  SharedProgram m_mergePrimitiveProgram;
+  SharedProgram m_primitiveSortKeysProgram;
+  SharedProgram m_gatherPrimitiveProgram;
+  SharedProgram m_mortonCodeProgram;
 
   SharedProgram m_motionVectorProgram;
+  SharedVertexArray m_pullVertexArray; // no attributes, MotionVectors.vsh pulls its vertices
   SharedProgram m_txaaProg;
 
-  SharedShaderStorageBuffer m_camDataBuffer;
-  SharedShaderStorageBuffer m_primitiveBuffer;
-  SharedShaderStorageBuffer m_lightDataBuffer;
-  SharedShaderStorageBuffer m_materialDataBuffer;
+  // Per-frame data (camera, lights, draw transforms) is written into the
+  // ring and bound by range, no buffer is reallocated for it
+  UploadRing m_uploadRing;
+  GrowableBuffer m_primitiveBuffer;
+  SharedShaderStorageBuffer m_workQueueBuffer;
+
+  // Morton ordering of the primitive buffer
+  GpuPrimitives m_gpuPrimitives;
+  GrowableBuffer m_primitiveSortKeys;
+  GrowableBuffer m_primitiveSortValues;
+  GrowableBuffer m_sortedPrimitiveBuffer;
+  GrowableBuffer m_centroidBuffer;
+  SharedShaderStorageBuffer m_sceneBoundsBuffer;
+  bool m_sortPrimitives = false;
+  bool m_use64BitMorton = false;
+
+  // Where each draw call's primitives live in m_primitiveBuffer and what
+  // they were built from. Draw calls that match last frame are not copied
+  // again; any change to the set of draw calls lays the buffer out anew.
+  // With sorting on, m_primitiveBuffer keeps the submission order and the
+  // tracer reads m_sortedPrimitiveBuffer.
+  struct ResidentDrawCall {
+    uint64_t id;
+    GLuint vao;
+    glm::mat4 transform;
+    MaterialHandle material;
+    int drawIndex;
+    size_t primitiveOffset;
+    size_t primitiveCount;
+  };
+  std::vector<ResidentDrawCall> m_residentDrawCalls;
+  bool m_residentSorted = false;
+  bool m_primitivesValid = false;
+  size_t m_copiedPrimitiveCount = 0;
+  bool m_primitiveOverflowReported = false;
+
+  // World space boxes of m_residentDrawCalls. Each pass rasterizes only
+  // the draw calls in its frustum, the tracer still sees all of them.
+  CullingBoxes m_drawCallBounds;
+  std::vector<uint8_t> m_drawCallVisible;
+  std::vector<GLint> m_rasterFirsts;
+  std::vector<GLsizei> m_rasterCounts;
+  bool m_frustumCulling = true;
+  bool m_simdCulling = true;
+  size_t m_rasterizedDrawCalls = 0;
+
+  // World space radiance cache for early path termination
+  SharedShaderStorageBuffer m_radianceCacheBuffer;
+  SharedProgram m_radianceCacheUpdateProgram;
+  bool m_radianceCacheEnabled = false;
+  int m_radianceCacheMaxSamples = 1024;
+  int m_radianceCacheMaxAge = 120;
+
+  void clearRadianceCache();
+
+  // Baked irradiance probes that terminated paths fall back to. Loaded from
+  // the resource directory and enabled by default on low quality.
+  IrradianceVolume m_irradianceVolume;
+  SharedShaderStorageBuffer m_irradianceVolumeBuffer;
+  IrradianceBakeSettings m_irradianceBakeSettings;
+  bool m_irradianceVolumeEnabled = false;
+  bool m_bakeIrradianceVolume = false;
+
+  std::string getIrradianceVolumePath();
+  void uploadIrradianceVolume();
+  void bakeIrradianceVolume(size_t primitiveCount, const std::vector<BakeMaterial>& materials,
+                            const std::vector<BakeLight>& lights);
+
+  // Primary hits taken from the rasterized visibility buffer
+  GrowableBuffer m_primitiveRemapBuffer;
+  bool m_hybridPrimary = false;
+
+  // Denoiser applied to the tracer output ahead of TXAA
+  std::shared_ptr<SVGFPostFX> m_svgf;
+
+  // Reads back the composited frame and writes it next to a copy filtered
+  // by the CPU denoiser
+  void exportDenoisedFrame(const std::string& path);
+
+  // Interleaved tracing: 1 traces every pixel, 2 a checkerboard, 4 one
+  // pixel per 2x2 quad each frame
+  SharedProgram m_reconstructProgram;
+  int m_interleave = 1;
+
+  // Spreads a fixed sample budget towards pixels whose TXAA history was
+  // rejected, see SampleAllocation.glsl
+  SharedProgram m_sampleAllocationProgram;
+  SharedShaderStorageBuffer m_sampleAllocationBuffer;
+  bool m_adaptiveSampling = false;
+
+  // ReSTIR direct illumination
+  bool m_restirEnabled = false;
+
+  void ensureReservoirs(RenderPass &pass, size_t count);
+
+  // Dynamic resolution: the G-buffer and tracer only fill a sub-rectangle of
+  // their targets that is scaled to keep the GPU frame time on budget. The
+  // frame time is the profiler's "Frame" scope.
+  float m_gpuFrameTimeMs = 0;
+  bool m_dynamicResolution = false;
+  float m_targetFrameTimeMs = 16.0f;
+  float m_minResolutionScale = 0.5f;
+  float m_maxResolutionScale = 1.0f;
+  float m_resolutionScale = 1.0f;
+
+  void updateResolutionScale();
+  glm::ivec2 getRenderSize();
+
+  // Persistent-threads dispatch of the tracing kernel
+  bool m_persistentThreads = false;
+  int m_persistentGroupCount = 64;
 
   uint64_t m_frameIndex = 0;
 
+  void prepareScene(double interp);
   void render(RenderPass &pass, double interp, double totalTime);
 
 public:
@@ -111,19 +323,60 @@ public:
 
   void addRenderPass(Entity cam, StringHash name,
                      ScreenSpaceSize size = ScreenSpaceSize::FULL) {
+    if (m_passes.size() >= MAX_RENDER_PASSES) {
+      glow::error() << "Only " << MAX_RENDER_PASSES << " render passes fit into a pass mask\n";
+      return;
+    }
+
     cam.component<Camera>()->renderPassIndex = m_passes.size();
-    auto target = Framebuffer::create({ { "oColor", createScreenspaceTexture(size, GL_RGBA32F) } });
+    auto target = Framebuffer::create({ { "oColor", createScreenspaceTexture(size, GL_RGBA32F) },
+                                        { "oHistoryLength", createScreenspaceTexture(size, GL_R16F) } });
+
+    auto txaa = Framebuffer::create({ { "oColor", createScreenspaceTexture(size, GL_RGBA32F) },
+                                      { "oHistoryLength", createScreenspaceTexture(size, GL_R16F) } });
+
+    // The history length must not start out as garbage
+    for (auto fb : { target, txaa }) {
+      auto boundFb = fb->bind();
+      glClear(GL_COLOR_BUFFER_BIT);
+    }
 
-    auto txaa = Framebuffer::create({ { "oColor", createScreenspaceTexture(size, GL_RGBA32F) } });
     auto depth = Framebuffer::create({ { "oColor", createScreenspaceTexture(size, GL_R32F) } });
 
     m_passIds[name] = m_passes.size();
-    m_passes.push_back({kilobytes(4), kilobytes(4), kilobytes(4), target, txaa, depth,
-                        cam, true, false, false});
+    m_passes.push_back({target, txaa, depth, cam, true, false, false});
+    m_passes.back().lastRenderSize = glm::ivec2(0);
+    m_passes.back().lightCount = 0;
   }
 
+  // Geometry that was changed in place keeps its vertex array, so its
+  // primitives have to be copied again explicitly
+  void invalidatePrimitives() {
+    m_primitivesValid = false;
+  }
+
+  // Materials are stored once, drawables refer to them by handle. Changes
+  // through editMaterial or setMaterial are uploaded with the next frame.
+  MaterialHandle registerMaterial(const Material& material) {
+    return m_materials.add(material);
+  }
+
+  const Material& getMaterial(MaterialHandle handle) const {
+    return m_materials.get(handle);
+  }
+
+  Material& editMaterial(MaterialHandle handle) {
+    return m_materials.edit(handle);
+  }
+
+  void setMaterial(MaterialHandle handle, const Material& material) {
+    m_materials.set(handle, material);
+  }
+
+  // Also gives the texture its index in the texture table
   void registerTexture(glow::SharedTexture2D tex) {
       m_registeredTextures.push_back(tex);
+      m_textureTable.add(tex);
   }
 
   void setRenderPassSSAO(StringHash pass, bool active) {
@@ -171,18 +424,14 @@ public:
 
   inline size_t getNumPasses() { return m_passes.size(); }
 
-  inline void submit(DrawCall drawCall, uint32_t passIndex = 0) {
-    if (passIndex >= m_passes.size())
-      return;
-
-    m_passes[passIndex].submittedDrawCallsOpaque.push(drawCall);
+  // Submitted once per frame for all passes, each pass only sees the draw
+  // calls and lights with its bit in renderPassMask
+  inline void submit(DrawCall drawCall) {
+    m_submittedDrawCalls.push(drawCall);
   }
 
-  inline void submit(LightData light, uint32_t passIndex = 0) {
-    if (passIndex >= m_passes.size())
-      return;
-
-    m_passes[passIndex].submittedLights.push(light);
+  inline void submit(LightData light) {
+    m_submittedLights.push(light);
   }
 
   inline SharedLocationMapping getGBufferLocations() {
@@ -220,7 +469,8 @@ public:
 
   void frame(double interp, double totalTime);
 
-  void showTextureChooser(glow::SharedTexture2D& tex, std::string id);
+  // Returns true if a different texture was picked
+  bool showTextureChooser(glow::SharedTexture2D& tex, std::string id);
 };
 
 glm::mat4 interpolate(TransformData a, TransformData b, double t);
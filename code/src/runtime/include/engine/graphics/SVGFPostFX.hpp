@@ -0,0 +1,59 @@
+#pragma once
+
+#include <engine/graphics/PostFX.hpp>
+
+#undef near
+#undef far
+
+// Temporal state of the denoiser, kept per render pass
+struct SVGFHistory {
+  glow::SharedTexture2D color[2];       // rgb: accumulated color, a: history length
+  glow::SharedTexture2D moments[2];     // xy: luminance moments
+  glow::SharedTexture2D normalDepth[2]; // xy: encoded normal, z: linear depth, w: depth gradient
+  int current;
+  bool valid;
+};
+
+// Spatiotemporal variance-guided filter for the noisy tracer output. Runs
+// ahead of TXAA and is guided by the rasterized normal, motion and depth.
+class SVGFPostFX : public PostFX {
+private:
+  glow::SharedProgram m_reprojectProgram;
+  glow::SharedProgram m_varianceProgram;
+  glow::SharedProgram m_atrousProgram;
+
+  glow::SharedTexture2D m_filterTextures[2];
+
+  glow::SharedTexture2D m_normalMotion;
+  glow::SharedTexture2D m_depth;
+  float m_near;
+  float m_far;
+  glm::ivec2 m_renderSize;
+  glm::ivec2 m_prevRenderSize;
+  SVGFHistory* m_history;
+
+  int m_iterations = 5;
+  float m_colorAlpha = 0.2f;
+  float m_momentsAlpha = 0.2f;
+  float m_phiColor = 4.0f;
+  float m_phiNormal = 128.0f;
+  float m_phiDepth = 1.0f;
+
+  void ensureTextures(int width, int height);
+
+public:
+  SVGFPostFX(RendererSystem* renderer, EventSystem* events, QualitySetting quality) : PostFX(renderer, events, quality) { };
+
+  // The render sizes give the part of the textures that holds this and last
+  // frame's image when rendering at a reduced resolution
+  void setGuides(glow::SharedTexture2D normalMotion, glow::SharedTexture2D depth,
+                 float near, float far, glm::ivec2 renderSize, glm::ivec2 prevRenderSize,
+                 SVGFHistory* history);
+
+  void startup() override;
+  void apply(glow::SharedTexture2D inputBuffer, glow::SharedFramebuffer outputBuffer) override;
+  void shutdown() override;
+  const char* name() const override { return "SVGF"; }
+
+  void drawUI();
+};
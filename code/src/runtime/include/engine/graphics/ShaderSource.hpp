@@ -0,0 +1,11 @@
+#pragma once
+
+#include <string>
+
+// Reads a GLSL file and pastes every #include "file" in its place, resolved
+// relative to the including file like shaders loaded from files. Each file
+// is pasted once. Returns an empty string if a file can't be read.
+//
+// For shaders that are compiled from a string with generated lines in front
+// of them, which have no file of their own to resolve includes against.
+std::string expandShaderIncludes(const std::string& path);
@@ -0,0 +1,59 @@
+#pragma once
+#include <glow/fwd.hh>
+#include <glow/gl.hh>
+#include <glm/glm.hpp>
+
+#include <unordered_map>
+#include <vector>
+
+// Material textures under stable indices that are assigned once, when a
+// texture is added. The tracer looks an index up in a storage buffer of
+// uvec2 entries (TextureTable.glsl):
+//  - with ARB_bindless_texture an entry is the resident texture handle,
+//  - otherwise textures are copied into GL_TEXTURE_2D_ARRAYs, one per
+//    size and format, and an entry is (array, layer).
+class TextureTable {
+public:
+  static const uint32_t NO_TEXTURE = 0xFFFFFFFFu;
+  // Texture units 0 to MAX_TEXTURE_ARRAYS - 1 hold the arrays
+  static const int MAX_TEXTURE_ARRAYS = 8;
+
+private:
+  struct TextureArray {
+    GLuint texture;
+    GLsizei width;
+    GLsizei height;
+    GLint internalFormat;
+    GLsizei layers;
+  };
+
+  bool m_bindless = false;
+  glow::SharedShaderStorageBuffer m_entryBuffer;
+  std::vector<glm::uvec2> m_entries;
+  std::unordered_map<GLuint, uint32_t> m_indices;
+  std::vector<glow::SharedTexture2D> m_textures;
+  std::vector<TextureArray> m_arrays;
+  std::vector<GLuint> m_arrayNames;
+
+  bool addToArray(GLuint texture, glm::uvec2& entry);
+  void growArray(TextureArray& array, GLsizei layers);
+
+public:
+  void create(bool bindless);
+  void destroy();
+
+  // Returns the index of tex, adding it on first use. Adding a texture
+  // makes its parameters immutable in bindless mode.
+  uint32_t add(const glow::SharedTexture2D& tex);
+
+  // NO_TEXTURE for null
+  uint32_t indexOf(const glow::SharedTexture2D& tex);
+
+  // Binds the arrays to their units, nothing to do for bindless handles
+  void bind() const;
+
+  inline bool isBindless() const { return m_bindless; }
+  inline size_t size() const { return m_entries.size(); }
+  inline size_t arrayCount() const { return m_arrays.size(); }
+  inline const glow::SharedShaderStorageBuffer& entryBuffer() const { return m_entryBuffer; }
+};
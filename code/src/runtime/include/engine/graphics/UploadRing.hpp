@@ -0,0 +1,83 @@
+#pragma once
+#include <glow/fwd.hh>
+#include <glow/gl.hh>
+
+#include <cstring>
+#include <vector>
+
+// Per-frame upload memory. One buffer is split into a region per frame in
+// flight; every frame sub-allocates from its region and binds the pieces
+// by range. A fence per region keeps the CPU from overwriting data the GPU
+// may still read. The buffer is persistently mapped where GL 4.4 buffer
+// storage is available, otherwise data goes through glBufferSubData
+// without orphaning.
+class UploadRing {
+public:
+  static const int FRAMES_IN_FLIGHT = 3;
+
+  struct Allocation {
+    GLuint buffer = 0;
+    size_t offset = 0;
+    size_t size = 0;
+
+    // Points the storage block of program at `binding` and binds the range
+    // there. Use bindings no buffer set through glow can end up on.
+    void bind(GLuint program, const char* blockName, GLuint binding) const;
+  };
+
+private:
+  GLuint m_buffer = 0;
+  uint8_t* m_mapped = nullptr;
+  bool m_persistent = false;
+  size_t m_regionSize = 0;
+  size_t m_alignment = 256;
+  GLuint m_maxBindings = 8; // GL 4.3 minimum of GL_MAX_SHADER_STORAGE_BUFFER_BINDINGS
+
+  int m_region = 0;
+  size_t m_offset = 0;
+  GLsync m_fences[FRAMES_IN_FLIGHT] = {};
+
+  // Buffers replaced by a larger one, deleted once no frame can use them
+  struct RetiredBuffer {
+    GLuint buffer;
+    int framesLeft;
+  };
+  std::vector<RetiredBuffer> m_retired;
+
+  size_t m_peakUsage = 0;
+  size_t m_fenceWaits = 0;
+
+  void createBuffer(size_t regionSize);
+  void releaseBuffer();
+
+public:
+  void create(size_t regionSize);
+  void destroy();
+
+  // Moves to the next region, waiting for the GPU if it still reads it
+  void beginFrame();
+  // Fences everything that was submitted with this frame's region
+  void endFrame();
+
+  Allocation allocate(const void* data, size_t bytes);
+
+  // Picks `count` consecutive storage buffer bindings starting at `lowest`
+  // for Allocation::bind. Logs an error and returns false if the driver
+  // has fewer binding points than that.
+  bool reserveBindings(GLuint lowest, GLuint count, GLuint& first) const;
+
+  template <typename T>
+  Allocation allocate(const T& value) {
+    return allocate(&value, sizeof(T));
+  }
+
+  template <typename T>
+  Allocation allocate(const std::vector<T>& values) {
+    return allocate(values.data(), values.size() * sizeof(T));
+  }
+
+  inline bool isPersistent() const { return m_persistent; }
+  inline size_t regionSize() const { return m_regionSize; }
+  inline size_t peakUsage() const { return m_peakUsage; }
+  inline size_t fenceWaits() const { return m_fenceWaits; }
+};
@@ -4,10 +4,11 @@
 #include <engine/graphics/Material.hpp>
 
 struct Drawable : Component<Drawable> {
-  explicit Drawable(Geometry geom, Material mat, uint32_t renderPassIndex = 0) : geometry(geom), material(mat), renderPassIndex(renderPassIndex){}
+  explicit Drawable(Geometry geom, MaterialHandle mat, uint32_t renderPassMask = ~0u)
+    : geometry(geom), material(mat), renderPassMask(renderPassMask){}
   Geometry geometry;
-  Material material;
+  MaterialHandle material; // see RendererSystem::registerMaterial
   bool visible = true;
-  uint32_t renderPassIndex;
+  uint32_t renderPassMask; // bit i: seen by render pass i, every pass by default
 };
 
@@ -0,0 +1,27 @@
+#pragma once
+
+// Runtime dispatch for the SIMD paths. Code compiled with ORION_TARGET_AVX
+// or ORION_TARGET_AVX2 may only run once the matching check passed.
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define ORION_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#else
+#define ORION_X86 0
+#endif
+
+// MSVC emits AVX and AVX2 intrinsics without per-function target flags
+#if ORION_X86 && !defined(_MSC_VER)
+#define ORION_TARGET_AVX __attribute__((target("avx")))
+#define ORION_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define ORION_TARGET_AVX
+#define ORION_TARGET_AVX2
+#endif
+
+// Both also check that the OS saves the YMM registers. Queried once.
+bool cpuHasAVX();
+bool cpuHasAVX2(); // AVX2 and FMA
@@ -1,5 +1,6 @@
 #include <engine/graphics/BloomPostFX.hpp>
 #include <engine/graphics/RendererSystem.hpp>
+#include <engine/graphics/RenderGraph.hpp>
 #include <engine/events/EventSystem.hpp>
 #include <engine/ui/UISystem.hpp>
 #include <glow/objects/Framebuffer.hh>
@@ -18,15 +19,6 @@ float computeGaussian(float n) {
 
 void BloomPostFX::startup() {
 
-  m_extractTexture = m_renderer->createScreenspaceTexture(ScreenSpaceSize::HALF, GL_RGBA32F);
-  m_extractBuffer = Framebuffer::create({{ "oColor", m_extractTexture }});
-
-  m_blurTextureHorizontal = m_renderer->createScreenspaceTexture(ScreenSpaceSize::HALF, GL_RGBA32F);
-  m_blurBufferHorizontal = Framebuffer::create({ { "oColor", m_blurTextureHorizontal } });
-
-  m_blurTextureVertical = m_renderer->createScreenspaceTexture(ScreenSpaceSize::HALF, GL_RGBA32F);
-  m_blurBufferVertical = Framebuffer::create({ { "oColor", m_blurTextureVertical } });
-
   m_blitProgram = Program::createFromFile("Bloom/Blit");
   m_extractProgram = Program::createFromFile("Bloom/Extract");
   m_blurProgram = Program::createFromFile("Bloom/Blur");
@@ -58,90 +50,101 @@ void BloomPostFX::startup() {
 
 }
 
-void BloomPostFX::apply(glow::SharedTexture2D inputBuffer, glow::SharedFramebuffer outputBuffer) {
-
-  auto bloomSize = glm::vec2(m_extractTexture->getWidth(), m_extractTexture->getHeight());
-
-  glDisable(GL_BLEND);
+void BloomPostFX::blur(SharedTexture2D source, SharedFramebuffer target, glm::vec2 direction, float scale) {
+  std::array<glm::vec2, 15> offsets;
+  for (size_t i = 0; i < offsets.size(); i++) {
+    offsets[i] = direction * m_sampleOffsets[i] * scale / glm::vec2(source->getWidth(), source->getHeight());
+  }
 
-  // Extract bright pixels
-  auto boundBuffer = m_extractBuffer->bind();
+  auto boundFB = target->bind();
   glClear(GL_COLOR_BUFFER_BIT);
-  glViewport(0, 0, (int)bloomSize.x, (int)bloomSize.y);
 
-  auto extractProgramUsed = m_extractProgram->use();
-  extractProgramUsed.setTexture("uSamplerColor", inputBuffer);
-  extractProgramUsed.setUniform("uThreshold", 0.9f);
+  auto blurProgramUsed = m_blurProgram->use();
+  blurProgramUsed.setUniform("uSampleWeights", m_gaussianWeights.size(),
+                             m_gaussianWeights.data());
+  blurProgramUsed.setTexture("uSamplerColor", source);
+  blurProgramUsed.setUniform("uSampleOffsets", offsets.size(),
+                             offsets.data());
   glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
 
-  std::array<glm::vec2, 15> offsets;
+void BloomPostFX::declare(RenderGraph& graph, RenderGraphTexture input, RenderGraphTexture output) {
+  // The extract target is done after the first horizontal blur, so the
+  // vertical one can take its place in the pool
+  auto extract = graph.createTexture("Bloom Extract", ScreenSpaceSize::HALF, GL_RGBA32F);
+  auto blurHorizontal = graph.createTexture("Bloom Blur Horizontal", ScreenSpaceSize::HALF, GL_RGBA32F);
+  auto blurVertical = graph.createTexture("Bloom Blur Vertical", ScreenSpaceSize::HALF, GL_RGBA32F);
+
+  // Extract bright pixels
+  graph.addPass("Bloom Extract", { { input, RenderGraphAccess::Sampled } },
+                { { extract, RenderGraphAccess::RenderTarget } },
+                [this, input, extract](RenderGraph& graph) {
+    auto extractTexture = graph.getTexture(extract);
+
+    glDisable(GL_BLEND);
+    auto boundBuffer = graph.getFramebuffer(extract)->bind();
+    glClear(GL_COLOR_BUFFER_BIT);
+    glViewport(0, 0, extractTexture->getWidth(), extractTexture->getHeight());
+
+    auto extractProgramUsed = m_extractProgram->use();
+    extractProgramUsed.setTexture("uSamplerColor", graph.getTexture(input));
+    extractProgramUsed.setUniform("uThreshold", 0.9f);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  });
+
+  graph.addPass("Bloom Copy", { { input, RenderGraphAccess::Sampled } },
+                { { output, RenderGraphAccess::RenderTarget } },
+                [this, input, output](RenderGraph& graph) {
+    auto inputTexture = graph.getTexture(input);
+
+    auto boundFB = graph.getFramebuffer(output)->bind();
+    glClear(GL_COLOR_BUFFER_BIT);
+    glViewport(0, 0, inputTexture->getWidth(), inputTexture->getHeight());
+    auto blitProgramUsed = m_blitProgram->use();
+    blitProgramUsed.setTexture("uSamplerBlur", inputTexture);
+    blitProgramUsed.setUniform("uBloomFactor", 1.0f);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  });
 
   const static float weights[] = { 1, 0.75, 0.25 };
   const static float scales[] = { 1, 2, 4.0 };
-  
-  {
-      auto boundFB = outputBuffer->bind();
-      glClear(GL_COLOR_BUFFER_BIT);
-      glViewport(0, 0, inputBuffer->getWidth(), inputBuffer->getHeight());
-      auto blitProgramUsed = m_blitProgram->use();
-      blitProgramUsed.setTexture("uSamplerBlur", inputBuffer);
-      blitProgramUsed.setUniform("uBloomFactor", 1.0f);
-      glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-  }
 
-  auto blurSrc = m_extractTexture;
+  auto blurSrc = extract;
 
   for (int pass = 0; pass < (int)m_quality + 1; pass++) {
-    glViewport(0, 0, (int)bloomSize.x, (int)bloomSize.y);
-
-    {
-      auto blurProgramUsed = m_blurProgram->use();
-
-      {
-        // Blur horizontally
-        auto boundFB = m_blurBufferHorizontal->bind();
-        blurProgramUsed.setUniform("uSampleWeights", m_gaussianWeights.size(),
-                                   m_gaussianWeights.data());
-
-        blurProgramUsed.setTexture("uSamplerColor", blurSrc);
-        for (size_t i = 0; i < offsets.size(); i++) {
-          offsets[i] = glm::vec2(
-              m_sampleOffsets[i] * scales[pass] / blurSrc->getWidth(), 0);
-        }
-        blurProgramUsed.setUniform("uSampleOffsets", offsets.size(),
-                                   offsets.data());
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-      }
-
-      {
-        // Blur vertically
-        auto boundFB = m_blurBufferVertical->bind();
-        glClear(GL_COLOR_BUFFER_BIT);
-        blurProgramUsed.setTexture("uSamplerColor", m_blurTextureHorizontal);
-
-        for (size_t i = 0; i < offsets.size(); i++) {
-          offsets[i] = glm::vec2(0, m_sampleOffsets[i] * scales[pass] /
-                                        m_blurTextureHorizontal->getHeight());
-        }
-        blurProgramUsed.setUniform("uSampleOffsets", offsets.size(),
-                                   offsets.data());
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-      }
-    }
-
-    {
-      // Add to output
+    graph.addPass("Bloom Blur Horizontal", { { blurSrc, RenderGraphAccess::Sampled } },
+                  { { blurHorizontal, RenderGraphAccess::RenderTarget } },
+                  [this, blurSrc, blurHorizontal, pass](RenderGraph& graph) {
+      auto target = graph.getTexture(blurHorizontal);
+      glViewport(0, 0, target->getWidth(), target->getHeight());
+      blur(graph.getTexture(blurSrc), graph.getFramebuffer(blurHorizontal), glm::vec2(1, 0), scales[pass]);
+    });
+
+    graph.addPass("Bloom Blur Vertical", { { blurHorizontal, RenderGraphAccess::Sampled } },
+                  { { blurVertical, RenderGraphAccess::RenderTarget } },
+                  [this, blurHorizontal, blurVertical, pass](RenderGraph& graph) {
+      blur(graph.getTexture(blurHorizontal), graph.getFramebuffer(blurVertical), glm::vec2(0, 1), scales[pass]);
+    });
+
+    // Add to output
+    graph.addPass("Bloom Add", { { blurVertical, RenderGraphAccess::Sampled } },
+                  { { output, RenderGraphAccess::RenderTarget } },
+                  [this, blurVertical, output, pass](RenderGraph& graph) {
+      auto outputBuffer = graph.getFramebuffer(output);
+      auto outputSize = outputBuffer->getDim();
+
       glEnable(GL_BLEND);
       glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-      glViewport(0, 0, inputBuffer->getWidth(), inputBuffer->getHeight());
+      glViewport(0, 0, outputSize.x, outputSize.y);
       auto boundFB = outputBuffer->bind();
       auto blitProgramUsed = m_blitProgram->use();
-      blitProgramUsed.setTexture("uSamplerBlur", m_blurTextureVertical);
+      blitProgramUsed.setTexture("uSamplerBlur", graph.getTexture(blurVertical));
       blitProgramUsed.setUniform("uBloomFactor", weights[pass]);
       glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
       glDisable(GL_BLEND);
-    }
-    blurSrc = m_blurTextureVertical;
+    });
+
+    blurSrc = blurVertical;
   }
 }
 
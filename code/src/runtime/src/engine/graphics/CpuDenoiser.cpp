@@ -0,0 +1,424 @@
+#include <engine/graphics/CpuDenoiser.hpp>
+#include <engine/utils/CpuFeatures.hpp>
+#include <engine/utils/stb_image.h>
+#include <engine/utils/stb_image_write.h>
+#include <glow/common/log.hh>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstddef>
+#include <thread>
+
+// B3 spline, indexed by the absolute tap offset
+static const float KERNEL[3] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+// Planar copies of the buffers, so eight neighbouring pixels are one load
+struct FilterPass {
+  int width;
+  int height;
+  int step;
+
+  const float* srcR;
+  const float* srcG;
+  const float* srcB;
+  float* dstR;
+  float* dstG;
+  float* dstB;
+
+  const float* normalX; // null without normal guide
+  const float* normalY;
+  const float* normalZ;
+  const float* depth;   // null without depth guide
+
+  float invPhiColor;
+  float invPhiNormal;
+  float invPhiDepth;
+};
+
+static void filterPixel(const FilterPass& p, int x, int y) {
+  size_t center = (size_t)y * p.width + x;
+
+  float sumR = 0, sumG = 0, sumB = 0, sumW = 0;
+  for (int dy = -2; dy <= 2; dy++) {
+    int ty = y + dy * p.step;
+    if (ty < 0 || ty >= p.height) {
+      continue;
+    }
+
+    for (int dx = -2; dx <= 2; dx++) {
+      int tx = x + dx * p.step;
+      if (tx < 0 || tx >= p.width) {
+        continue;
+      }
+
+      size_t tap = (size_t)ty * p.width + tx;
+      float dr = p.srcR[tap] - p.srcR[center];
+      float dg = p.srcG[tap] - p.srcG[center];
+      float db = p.srcB[tap] - p.srcB[center];
+      float e = (dr * dr + dg * dg + db * db) * p.invPhiColor;
+
+      if (p.normalX) {
+        float nx = p.normalX[tap] - p.normalX[center];
+        float ny = p.normalY[tap] - p.normalY[center];
+        float nz = p.normalZ[tap] - p.normalZ[center];
+        e += (nx * nx + ny * ny + nz * nz) * p.invPhiNormal;
+      }
+
+      if (p.depth) {
+        float dz = p.depth[tap] - p.depth[center];
+        e += dz * dz * p.invPhiDepth;
+      }
+
+      float w = KERNEL[std::abs(dx)] * KERNEL[std::abs(dy)] * std::exp(-e);
+      sumR += p.srcR[tap] * w;
+      sumG += p.srcG[tap] * w;
+      sumB += p.srcB[tap] * w;
+      sumW += w;
+    }
+  }
+
+  p.dstR[center] = sumR / sumW;
+  p.dstG[center] = sumG / sumW;
+  p.dstB[center] = sumB / sumW;
+}
+
+#if ORION_X86
+// exp(x) for x <= 0 as 2^i * 2^f with a degree 5 polynomial for 2^f
+ORION_TARGET_AVX2 static inline __m256 expNegative(__m256 x) {
+  x = _mm256_max_ps(x, _mm256_set1_ps(-87.0f));
+  __m256 t = _mm256_mul_ps(x, _mm256_set1_ps(1.44269504f));
+  __m256 i = _mm256_floor_ps(t);
+  __m256 f = _mm256_sub_ps(t, i);
+
+  __m256 poly = _mm256_set1_ps(1.333355e-3f);
+  poly = _mm256_fmadd_ps(poly, f, _mm256_set1_ps(9.618129e-3f));
+  poly = _mm256_fmadd_ps(poly, f, _mm256_set1_ps(5.550411e-2f));
+  poly = _mm256_fmadd_ps(poly, f, _mm256_set1_ps(2.402265e-1f));
+  poly = _mm256_fmadd_ps(poly, f, _mm256_set1_ps(6.931472e-1f));
+  poly = _mm256_fmadd_ps(poly, f, _mm256_set1_ps(1.0f));
+
+  __m256i exponent = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(i), _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(poly, _mm256_castsi256_ps(exponent));
+}
+
+// Filters pixels [x0, x1) of row y, eight at a time. All taps must be inside
+// the image, the caller handles the borders and the remainder.
+ORION_TARGET_AVX2 static int filterSpanAVX2(const FilterPass& p, int x0, int x1, int y) {
+  int x = x0;
+  for (; x + 8 <= x1; x += 8) {
+    ptrdiff_t center = (ptrdiff_t)y * p.width + x;
+
+    __m256 cr = _mm256_loadu_ps(p.srcR + center);
+    __m256 cg = _mm256_loadu_ps(p.srcG + center);
+    __m256 cb = _mm256_loadu_ps(p.srcB + center);
+
+    __m256 cnx = _mm256_setzero_ps(), cny = _mm256_setzero_ps(), cnz = _mm256_setzero_ps();
+    if (p.normalX) {
+      cnx = _mm256_loadu_ps(p.normalX + center);
+      cny = _mm256_loadu_ps(p.normalY + center);
+      cnz = _mm256_loadu_ps(p.normalZ + center);
+    }
+    __m256 cz = p.depth ? _mm256_loadu_ps(p.depth + center) : _mm256_setzero_ps();
+
+    __m256 sumR = _mm256_setzero_ps();
+    __m256 sumG = _mm256_setzero_ps();
+    __m256 sumB = _mm256_setzero_ps();
+    __m256 sumW = _mm256_setzero_ps();
+
+    for (int dy = -2; dy <= 2; dy++) {
+      for (int dx = -2; dx <= 2; dx++) {
+        ptrdiff_t tap = center + (ptrdiff_t)dy * p.step * p.width + dx * p.step;
+
+        __m256 tr = _mm256_loadu_ps(p.srcR + tap);
+        __m256 tg = _mm256_loadu_ps(p.srcG + tap);
+        __m256 tb = _mm256_loadu_ps(p.srcB + tap);
+
+        __m256 d = _mm256_sub_ps(tr, cr);
+        __m256 dist = _mm256_mul_ps(d, d);
+        d = _mm256_sub_ps(tg, cg);
+        dist = _mm256_fmadd_ps(d, d, dist);
+        d = _mm256_sub_ps(tb, cb);
+        dist = _mm256_fmadd_ps(d, d, dist);
+        __m256 e = _mm256_mul_ps(dist, _mm256_set1_ps(p.invPhiColor));
+
+        if (p.normalX) {
+          d = _mm256_sub_ps(_mm256_loadu_ps(p.normalX + tap), cnx);
+          dist = _mm256_mul_ps(d, d);
+          d = _mm256_sub_ps(_mm256_loadu_ps(p.normalY + tap), cny);
+          dist = _mm256_fmadd_ps(d, d, dist);
+          d = _mm256_sub_ps(_mm256_loadu_ps(p.normalZ + tap), cnz);
+          dist = _mm256_fmadd_ps(d, d, dist);
+          e = _mm256_fmadd_ps(dist, _mm256_set1_ps(p.invPhiNormal), e);
+        }
+
+        if (p.depth) {
+          d = _mm256_sub_ps(_mm256_loadu_ps(p.depth + tap), cz);
+          e = _mm256_fmadd_ps(_mm256_mul_ps(d, d), _mm256_set1_ps(p.invPhiDepth), e);
+        }
+
+        __m256 h = _mm256_set1_ps(KERNEL[std::abs(dx)] * KERNEL[std::abs(dy)]);
+        __m256 w = _mm256_mul_ps(h, expNegative(_mm256_sub_ps(_mm256_setzero_ps(), e)));
+
+        sumR = _mm256_fmadd_ps(w, tr, sumR);
+        sumG = _mm256_fmadd_ps(w, tg, sumG);
+        sumB = _mm256_fmadd_ps(w, tb, sumB);
+        sumW = _mm256_add_ps(sumW, w);
+      }
+    }
+
+    __m256 invW = _mm256_div_ps(_mm256_set1_ps(1.0f), sumW);
+    _mm256_storeu_ps(p.dstR + center, _mm256_mul_ps(sumR, invW));
+    _mm256_storeu_ps(p.dstG + center, _mm256_mul_ps(sumG, invW));
+    _mm256_storeu_ps(p.dstB + center, _mm256_mul_ps(sumB, invW));
+  }
+  return x;
+}
+#endif
+
+static void filterTile(const FilterPass& p, int tileX, int tileY, int tileSize, bool useSimd) {
+  int border = 2 * p.step;
+  int xEnd = std::min(tileX + tileSize, p.width);
+  int yEnd = std::min(tileY + tileSize, p.height);
+
+  for (int y = tileY; y < yEnd; y++) {
+    int x = tileX;
+
+#if ORION_X86
+    if (useSimd && y >= border && y < p.height - border) {
+      int interiorBegin = std::min(std::max(tileX, border), xEnd);
+      int interiorEnd = std::min(xEnd, p.width - border);
+
+      for (; x < interiorBegin; x++) {
+        filterPixel(p, x, y);
+      }
+
+      if (interiorEnd > x) {
+        x = filterSpanAVX2(p, x, interiorEnd, y);
+      }
+    }
+#endif
+
+    for (; x < xEnd; x++) {
+      filterPixel(p, x, y);
+    }
+  }
+}
+
+bool CpuDenoiser::hasAVX2() {
+  return cpuHasAVX2();
+}
+
+void CpuDenoiser::denoise(const DenoiseInput& input, float* output, const DenoiseSettings& settings) {
+  int width = input.width;
+  int height = input.height;
+  size_t pixelCount = (size_t)width * height;
+
+  // Deinterleave, filtering illumination instead of color if there is albedo
+  std::vector<float> planes[2][3];
+  for (int buffer = 0; buffer < 2; buffer++) {
+    for (int c = 0; c < 3; c++) {
+      planes[buffer][c].resize(pixelCount);
+    }
+  }
+
+  for (size_t i = 0; i < pixelCount; i++) {
+    for (int c = 0; c < 3; c++) {
+      float value = input.color[i * 3 + c];
+      if (input.albedo) {
+        value /= std::max(input.albedo[i * 3 + c], 1e-3f);
+      }
+      planes[0][c][i] = value;
+    }
+  }
+
+  std::vector<float> normals[3];
+  if (input.normal) {
+    for (int c = 0; c < 3; c++) {
+      normals[c].resize(pixelCount);
+      for (size_t i = 0; i < pixelCount; i++) {
+        normals[c][i] = input.normal[i * 3 + c];
+      }
+    }
+  }
+
+  bool useSimd = settings.allowSimd && hasAVX2();
+  int tileSize = std::max(8, settings.tileSize);
+  int tilesX = (width + tileSize - 1) / tileSize;
+  int tilesY = (height + tileSize - 1) / tileSize;
+  int tileCount = tilesX * tilesY;
+
+  int threadCount = settings.threadCount > 0 ? settings.threadCount : (int)std::thread::hardware_concurrency();
+  threadCount = std::max(1, std::min(threadCount, tileCount));
+
+  int src = 0;
+  for (int iteration = 0; iteration < settings.iterations; iteration++) {
+    FilterPass pass;
+    pass.width = width;
+    pass.height = height;
+    pass.step = 1 << iteration;
+    pass.srcR = planes[src][0].data();
+    pass.srcG = planes[src][1].data();
+    pass.srcB = planes[src][2].data();
+    pass.dstR = planes[1 - src][0].data();
+    pass.dstG = planes[1 - src][1].data();
+    pass.dstB = planes[1 - src][2].data();
+    pass.normalX = input.normal ? normals[0].data() : nullptr;
+    pass.normalY = input.normal ? normals[1].data() : nullptr;
+    pass.normalZ = input.normal ? normals[2].data() : nullptr;
+    pass.depth = input.depth;
+
+    // Color edges get sharper with every iteration, normal edges are scaled
+    // by the distance between the taps
+    float phiColor = settings.phiColor / (float)(1 << iteration);
+    pass.invPhiColor = 1.0f / std::max(phiColor * phiColor, 1e-8f);
+    pass.invPhiNormal = 1.0f / std::max(settings.phiNormal * pass.step * pass.step, 1e-8f);
+    pass.invPhiDepth = 1.0f / std::max(settings.phiDepth * settings.phiDepth, 1e-8f);
+
+    std::atomic<int> nextTile(0);
+    auto worker = [&]() {
+      for (int tile = nextTile++; tile < tileCount; tile = nextTile++) {
+        filterTile(pass, (tile % tilesX) * tileSize, (tile / tilesX) * tileSize, tileSize, useSimd);
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < threadCount; i++) {
+      threads.emplace_back(worker);
+    }
+    worker();
+
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    src = 1 - src;
+  }
+
+  for (size_t i = 0; i < pixelCount; i++) {
+    for (int c = 0; c < 3; c++) {
+      float value = planes[src][c][i];
+      if (input.albedo) {
+        value *= std::max(input.albedo[i * 3 + c], 1e-3f);
+      }
+      output[i * 3 + c] = value;
+    }
+  }
+}
+
+// Loads an image as linear floats. LDR files are decoded from sRGB for
+// color, or mapped to [-1, 1] for normals.
+enum class ImageEncoding {
+  Color,
+  Normal,
+  Linear
+};
+
+static bool loadImage(const std::string& path, int channels, ImageEncoding encoding,
+                      std::vector<float>& pixels, int& width, int& height) {
+  int comp;
+  if (stbi_is_hdr(path.c_str())) {
+    float* data = stbi_loadf(path.c_str(), &width, &height, &comp, channels);
+    if (!data) {
+      return false;
+    }
+
+    pixels.assign(data, data + (size_t)width * height * channels);
+    stbi_image_free(data);
+    return true;
+  }
+
+  unsigned char* data = stbi_load(path.c_str(), &width, &height, &comp, channels);
+  if (!data) {
+    return false;
+  }
+
+  pixels.resize((size_t)width * height * channels);
+  for (size_t i = 0; i < pixels.size(); i++) {
+    float value = data[i] / 255.0f;
+    switch (encoding) {
+    case ImageEncoding::Color: value = std::pow(value, 2.2f); break;
+    case ImageEncoding::Normal: value = value * 2.0f - 1.0f; break;
+    case ImageEncoding::Linear: break;
+    }
+    pixels[i] = value;
+  }
+
+  stbi_image_free(data);
+  return true;
+}
+
+static bool writeImage(const std::string& path, int width, int height, const std::vector<float>& pixels) {
+  std::string extension = path.size() >= 4 ? path.substr(path.size() - 4) : "";
+  std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+  if (extension == ".hdr") {
+    return stbi_write_hdr(path.c_str(), width, height, 3, pixels.data()) != 0;
+  }
+
+  std::vector<unsigned char> ldr(pixels.size());
+  for (size_t i = 0; i < pixels.size(); i++) {
+    float value = std::pow(std::min(std::max(pixels[i], 0.0f), 1.0f), 1.0f / 2.2f);
+    ldr[i] = (unsigned char)(value * 255.0f + 0.5f);
+  }
+  return stbi_write_png(path.c_str(), width, height, 3, ldr.data(), width * 3) != 0;
+}
+
+bool CpuDenoiser::denoiseFiles(const std::string& colorPath, const std::string& albedoPath,
+                               const std::string& normalPath, const std::string& depthPath,
+                               const std::string& outputPath, const DenoiseSettings& settings) {
+  std::vector<float> color, albedo, normal, depth;
+  int width, height;
+
+  if (!loadImage(colorPath, 3, ImageEncoding::Color, color, width, height)) {
+    glow::error() << "Could not load " << colorPath << ": " << stbi_failure_reason();
+    return false;
+  }
+
+  // Guides have to match the color buffer
+  auto loadGuide = [&](const std::string& path, int channels, ImageEncoding encoding, std::vector<float>& pixels) {
+    if (path.empty()) {
+      return true;
+    }
+
+    int guideWidth, guideHeight;
+    if (!loadImage(path, channels, encoding, pixels, guideWidth, guideHeight)) {
+      glow::error() << "Could not load " << path << ": " << stbi_failure_reason();
+      return false;
+    }
+
+    if (guideWidth != width || guideHeight != height) {
+      glow::error() << path << " is " << guideWidth << "x" << guideHeight
+                    << ", expected " << width << "x" << height;
+      return false;
+    }
+    return true;
+  };
+
+  if (!loadGuide(albedoPath, 3, ImageEncoding::Color, albedo) ||
+      !loadGuide(normalPath, 3, ImageEncoding::Normal, normal) ||
+      !loadGuide(depthPath, 1, ImageEncoding::Linear, depth)) {
+    return false;
+  }
+
+  DenoiseInput input;
+  input.width = width;
+  input.height = height;
+  input.color = color.data();
+  input.albedo = albedo.empty() ? nullptr : albedo.data();
+  input.normal = normal.empty() ? nullptr : normal.data();
+  input.depth = depth.empty() ? nullptr : depth.data();
+
+  std::vector<float> result(color.size());
+  denoise(input, result.data(), settings);
+
+  if (!writeImage(outputPath, width, height, result)) {
+    glow::error() << "Could not write " << outputPath;
+    return false;
+  }
+
+  glow::info() << "Denoised " << colorPath << " to " << outputPath
+               << (settings.allowSimd && hasAVX2() ? " (AVX2)" : " (scalar)");
+  return true;
+}
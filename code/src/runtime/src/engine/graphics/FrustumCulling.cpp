@@ -0,0 +1,129 @@
+#include <engine/graphics/FrustumCulling.hpp>
+#include <engine/utils/CpuFeatures.hpp>
+
+#include <cmath>
+
+// Far enough out to never be culled, small enough to not overflow when
+// multiplied with a plane
+static const float UNBOUNDED = 1e30f;
+
+void CullingBoxes::clear() {
+  for (auto component : { &minX, &minY, &minZ, &maxX, &maxY, &maxZ }) {
+    component->clear();
+  }
+}
+
+void CullingBoxes::push(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& transform) {
+  glm::vec3 worldMin(-UNBOUNDED);
+  glm::vec3 worldMax(UNBOUNDED);
+
+  // The extents of the transformed box are the absolute matrix applied to
+  // the object space extents
+  if (boundsMin.x <= boundsMax.x) {
+    auto center = glm::vec3(transform * glm::vec4((boundsMin + boundsMax) * 0.5f, 1));
+    auto extent = (boundsMax - boundsMin) * 0.5f;
+
+    glm::vec3 worldExtent(0);
+    for (int col = 0; col < 3; col++) {
+      worldExtent += glm::abs(glm::vec3(transform[col])) * extent[col];
+    }
+
+    worldMin = center - worldExtent;
+    worldMax = center + worldExtent;
+  }
+
+  minX.push_back(worldMin.x);
+  minY.push_back(worldMin.y);
+  minZ.push_back(worldMin.z);
+  maxX.push_back(worldMax.x);
+  maxY.push_back(worldMax.y);
+  maxZ.push_back(worldMax.z);
+}
+
+// Gribb/Hartmann: the planes are sums and differences of the matrix rows,
+// normals point into the frustum
+static void extractPlanes(const glm::mat4& m, glm::vec4 planes[6]) {
+  glm::vec4 rows[4];
+  for (int i = 0; i < 4; i++) {
+    rows[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+  }
+
+  planes[0] = rows[3] + rows[0];
+  planes[1] = rows[3] - rows[0];
+  planes[2] = rows[3] + rows[1];
+  planes[3] = rows[3] - rows[1];
+  planes[4] = rows[3] + rows[2];
+  planes[5] = rows[3] - rows[2];
+}
+
+// A box is outside if its corner furthest along the plane normal is behind
+// the plane. Conservative, boxes crossing two planes near a frustum corner
+// are kept.
+static bool boxVisible(const glm::vec4 planes[6], const CullingBoxes& boxes, size_t i) {
+  for (int p = 0; p < 6; p++) {
+    auto& plane = planes[p];
+    float x = plane.x > 0 ? boxes.maxX[i] : boxes.minX[i];
+    float y = plane.y > 0 ? boxes.maxY[i] : boxes.minY[i];
+    float z = plane.z > 0 ? boxes.maxZ[i] : boxes.minZ[i];
+    if (plane.x * x + plane.y * y + plane.z * z + plane.w < 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#if ORION_X86
+// Tests boxes [0, count) eight at a time, returns the first box it didn't test
+ORION_TARGET_AVX static size_t cullAVX(const glm::vec4 planes[6], const CullingBoxes& boxes,
+                                       uint8_t* visible, size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 outside = _mm256_setzero_ps();
+
+    for (int p = 0; p < 6; p++) {
+      auto& plane = planes[p];
+
+      // The furthest corner picks the same side for all eight boxes
+      __m256 x = _mm256_loadu_ps((plane.x > 0 ? boxes.maxX : boxes.minX).data() + i);
+      __m256 y = _mm256_loadu_ps((plane.y > 0 ? boxes.maxY : boxes.minY).data() + i);
+      __m256 z = _mm256_loadu_ps((plane.z > 0 ? boxes.maxZ : boxes.minZ).data() + i);
+
+      __m256 dist = _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(plane.x)), _mm256_set1_ps(plane.w));
+      dist = _mm256_add_ps(dist, _mm256_mul_ps(y, _mm256_set1_ps(plane.y)));
+      dist = _mm256_add_ps(dist, _mm256_mul_ps(z, _mm256_set1_ps(plane.z)));
+
+      outside = _mm256_or_ps(outside, _mm256_cmp_ps(dist, _mm256_setzero_ps(), _CMP_LT_OQ));
+    }
+
+    int outsideMask = _mm256_movemask_ps(outside);
+    for (int lane = 0; lane < 8; lane++) {
+      visible[i + lane] = (outsideMask >> lane) & 1 ? 0 : 1;
+    }
+  }
+  return i;
+}
+#endif
+
+bool FrustumCulling::hasAVX() {
+  return cpuHasAVX();
+}
+
+void FrustumCulling::cull(const glm::mat4& viewProjection, const CullingBoxes& boxes,
+                          std::vector<uint8_t>& visible, bool allowSimd) {
+  glm::vec4 planes[6];
+  extractPlanes(viewProjection, planes);
+
+  size_t count = boxes.size();
+  visible.resize(count);
+
+  size_t i = 0;
+#if ORION_X86
+  if (allowSimd && hasAVX()) {
+    i = cullAVX(planes, boxes, visible.data(), count);
+  }
+#endif
+
+  for (; i < count; i++) {
+    visible[i] = boxVisible(planes, boxes, i) ? 1 : 0;
+  }
+}
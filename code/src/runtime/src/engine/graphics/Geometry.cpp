@@ -0,0 +1,39 @@
+#include <engine/graphics/Geometry.hpp>
+#include <glow/gl.hh>
+#include <glow/objects/ArrayBuffer.hh>
+#include <glow/objects/VertexArray.hh>
+
+#include <limits>
+#include <vector>
+
+using namespace glow;
+
+Geometry Geometry::create(SharedVertexArray vao) {
+  Geometry geometry;
+  geometry.vao = vao;
+
+  SharedArrayBuffer posBuffer;
+  if (!vao || !vao->getBufferForAttribute("aPosition", posBuffer)) {
+    return geometry;
+  }
+
+  // Positions are vec4s, like CopyPrimitive.csh reads them
+  GLint size = 0;
+  glBindBuffer(GL_ARRAY_BUFFER, posBuffer->getObjectName());
+  glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
+  std::vector<glm::vec4> positions(size / sizeof(glm::vec4));
+  glGetBufferSubData(GL_ARRAY_BUFFER, 0, positions.size() * sizeof(glm::vec4), positions.data());
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  if (positions.empty()) {
+    return geometry;
+  }
+
+  geometry.boundsMin = glm::vec3(std::numeric_limits<float>::max());
+  geometry.boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+  for (auto& pos : positions) {
+    geometry.boundsMin = glm::min(geometry.boundsMin, glm::vec3(pos));
+    geometry.boundsMax = glm::max(geometry.boundsMax, glm::vec3(pos));
+  }
+  return geometry;
+}
@@ -0,0 +1,443 @@
+#include <engine/graphics/GpuPrimitives.hpp>
+#include <glow/objects/Program.hh>
+#include <glow/objects/ShaderStorageBuffer.hh>
+#include <glow/common/log.hh>
+
+#include <engine/ui/imgui.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <sstream>
+
+using namespace glow;
+
+// Keep in sync with data/shader/compute/GpuPrimitivesCommon.glsl
+static const uint32_t RADIX_BITS = 4;
+static const uint32_t RADIX_SIZE = 16;
+static const uint32_t SORT_BLOCK_SIZE = 1024;
+static const uint32_t SCAN_BLOCK_SIZE = 512;
+static const uint32_t REDUCE_BLOCK_SIZE = 512;
+
+static uint32_t divUp(uint32_t a, uint32_t b) { return (a + b - 1) / b; }
+
+template <typename T>
+static std::vector<T> readBuffer(const SharedShaderStorageBuffer& buffer, size_t count) {
+  std::vector<T> result(count);
+  glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+  auto boundBuffer = buffer->bind();
+  glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(T), result.data());
+  return result;
+}
+
+static void copyBuffer(GLuint src, GLuint dst, size_t bytes) {
+  glBindBuffer(GL_COPY_READ_BUFFER, src);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, dst);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, bytes);
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void GpuScratchBuffer::ensureSize(size_t bytes) {
+  if (!buffer) {
+    buffer = ShaderStorageBuffer::create();
+  }
+
+  if (bytes > size) {
+    // Grow geometrically so slowly increasing inputs don't reallocate every frame
+    size = std::max(bytes, size + size / 2);
+    auto boundBuffer = buffer->bind();
+    boundBuffer.reserve(size, GL_DYNAMIC_DRAW);
+  }
+}
+
+void GpuPrimitives::startup() {
+  m_radixCountProgram = Program::createFromFile("compute/RadixSortCount.csh");
+  m_radixScatterProgram = Program::createFromFile("compute/RadixSortScatter.csh");
+  m_scanProgram = Program::createFromFile("compute/Scan.csh");
+  m_scanAddProgram = Program::createFromFile("compute/ScanAdd.csh");
+  m_compactProgram = Program::createFromFile("compute/Compact.csh");
+  m_reduceMinMaxProgram = Program::createFromFile("compute/ReduceMinMax.csh");
+}
+
+void GpuPrimitives::sortKeyValue(SharedShaderStorageBuffer keys, SharedShaderStorageBuffer values,
+                                 uint32_t count, uint32_t keyBits) {
+  if (count <= 1) {
+    return;
+  }
+
+  uint32_t blockCount = divUp(count, SORT_BLOCK_SIZE);
+  m_sortKeys.ensureSize(count * sizeof(uint32_t));
+  m_sortValues.ensureSize(count * sizeof(uint32_t));
+  m_histograms.ensureSize(RADIX_SIZE * blockCount * sizeof(uint32_t));
+
+  GLuint srcKeys = keys->getObjectName();
+  GLuint srcValues = values->getObjectName();
+  GLuint dstKeys = m_sortKeys.buffer->getObjectName();
+  GLuint dstValues = m_sortValues.buffer->getObjectName();
+
+  uint32_t passCount = divUp(keyBits, RADIX_BITS);
+
+  for (uint32_t pass = 0; pass < passCount; pass++) {
+    uint32_t shift = pass * RADIX_BITS;
+
+    {
+      auto boundCount = m_radixCountProgram->use();
+      boundCount.setUniform("uCount", count);
+      boundCount.setUniform("uShift", shift);
+      boundCount.setUniform("uBlockCount", blockCount);
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, srcKeys);
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_histograms.buffer->getObjectName());
+      boundCount.compute(blockCount);
+    }
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    exclusiveScan(m_histograms.buffer, RADIX_SIZE * blockCount);
+
+    {
+      auto boundScatter = m_radixScatterProgram->use();
+      boundScatter.setUniform("uCount", count);
+      boundScatter.setUniform("uShift", shift);
+      boundScatter.setUniform("uBlockCount", blockCount);
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, srcKeys);
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, srcValues);
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_histograms.buffer->getObjectName());
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, dstKeys);
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, dstValues);
+      boundScatter.compute(blockCount);
+    }
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    std::swap(srcKeys, dstKeys);
+    std::swap(srcValues, dstValues);
+  }
+
+  // After an odd number of passes the result lives in the scratch buffers
+  if (passCount % 2 == 1) {
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    copyBuffer(srcKeys, keys->getObjectName(), count * sizeof(uint32_t));
+    copyBuffer(srcValues, values->getObjectName(), count * sizeof(uint32_t));
+  }
+}
+
+void GpuPrimitives::scanLevel(GLuint data, uint32_t count, size_t level) {
+  uint32_t blockCount = divUp(count, SCAN_BLOCK_SIZE);
+
+  if (m_scanBlockSums.size() <= level) {
+    m_scanBlockSums.resize(level + 1);
+  }
+  m_scanBlockSums[level].ensureSize(blockCount * sizeof(uint32_t));
+  GLuint blockSums = m_scanBlockSums[level].buffer->getObjectName();
+
+  {
+    auto boundScan = m_scanProgram->use();
+    boundScan.setUniform("uCount", count);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, data);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, blockSums);
+    boundScan.compute(blockCount);
+  }
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  if (blockCount > 1) {
+    scanLevel(blockSums, blockCount, level + 1);
+
+    auto boundAdd = m_scanAddProgram->use();
+    boundAdd.setUniform("uCount", count);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, data);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, blockSums);
+    boundAdd.compute(blockCount);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+  }
+}
+
+void GpuPrimitives::exclusiveScan(SharedShaderStorageBuffer data, uint32_t count) {
+  if (count == 0) {
+    return;
+  }
+  scanLevel(data->getObjectName(), count, 0);
+}
+
+void GpuPrimitives::compact(SharedShaderStorageBuffer values, SharedShaderStorageBuffer flags,
+                            uint32_t count, SharedShaderStorageBuffer output,
+                            SharedShaderStorageBuffer outputCount) {
+  if (count == 0) {
+    return;
+  }
+
+  m_compactOffsets.ensureSize(count * sizeof(uint32_t));
+  copyBuffer(flags->getObjectName(), m_compactOffsets.buffer->getObjectName(), count * sizeof(uint32_t));
+  exclusiveScan(m_compactOffsets.buffer, count);
+
+  auto boundCompact = m_compactProgram->use();
+  boundCompact.setUniform("uCount", count);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, values->getObjectName());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, flags->getObjectName());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_compactOffsets.buffer->getObjectName());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, output->getObjectName());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, outputCount->getObjectName());
+  boundCompact.compute(divUp(count, 256));
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void GpuPrimitives::reduceMinMax(SharedShaderStorageBuffer data, uint32_t count,
+                                 SharedShaderStorageBuffer result) {
+  if (count == 0) {
+    return;
+  }
+
+  auto boundReduce = m_reduceMinMaxProgram->use();
+
+  GLuint input = data->getObjectName();
+  bool inputIsPairs = false;
+  int scratchIndex = 0;
+
+  while (true) {
+    uint32_t groupCount = divUp(count, REDUCE_BLOCK_SIZE);
+
+    GLuint output;
+    if (groupCount == 1) {
+      output = result->getObjectName();
+    } else {
+      auto& scratch = m_reduceScratch[scratchIndex];
+      scratch.ensureSize(groupCount * 2 * sizeof(glm::vec4));
+      output = scratch.buffer->getObjectName();
+      scratchIndex = 1 - scratchIndex;
+    }
+
+    boundReduce.setUniform("uCount", count);
+    boundReduce.setUniform("uInputIsPairs", inputIsPairs);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, input);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, output);
+    boundReduce.compute(groupCount);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    if (groupCount == 1) {
+      break;
+    }
+
+    input = output;
+    inputIsPairs = true;
+    count = groupCount;
+  }
+}
+
+bool GpuPrimitives::verify(uint32_t count) {
+  std::mt19937 rng(1337);
+  std::uniform_int_distribution<uint32_t> keyDist;
+  std::uniform_int_distribution<uint32_t> smallDist(0, 15);
+  std::uniform_real_distribution<float> floatDist(-1000.0f, 1000.0f);
+
+  std::stringstream log;
+  bool allPassed = true;
+
+  auto report = [&](const char* name, bool passed) {
+    log << name << ": " << (passed ? "passed" : "FAILED") << "\n";
+    allPassed &= passed;
+  };
+
+  auto keyBuffer = ShaderStorageBuffer::create();
+  auto valueBuffer = ShaderStorageBuffer::create();
+
+  // Radix sort
+  {
+    std::vector<uint32_t> keys(count);
+    std::vector<uint32_t> values(count);
+    for (uint32_t i = 0; i < count; i++) {
+      keys[i] = keyDist(rng);
+      values[i] = i;
+    }
+
+    keyBuffer->bind().setData(keys);
+    valueBuffer->bind().setData(values);
+    sortKeyValue(keyBuffer, valueBuffer, count);
+
+    std::vector<uint32_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+
+    auto gpuKeys = readBuffer<uint32_t>(keyBuffer, count);
+    auto gpuValues = readBuffer<uint32_t>(valueBuffer, count);
+
+    bool passed = true;
+    for (uint32_t i = 0; i < count && passed; i++) {
+      passed = gpuKeys[i] == keys[order[i]] && gpuValues[i] == order[i];
+    }
+    report("Radix sort", passed);
+  }
+
+  // Exclusive scan
+  std::vector<uint32_t> flags(count);
+  {
+    for (auto& flag : flags) {
+      flag = smallDist(rng) < 8 ? 1 : 0;
+    }
+
+    std::vector<uint32_t> data(count);
+    for (auto& val : data) {
+      val = smallDist(rng);
+    }
+
+    keyBuffer->bind().setData(data);
+    exclusiveScan(keyBuffer, count);
+    auto gpuData = readBuffer<uint32_t>(keyBuffer, count);
+
+    bool passed = true;
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < count && passed; i++) {
+      passed = gpuData[i] == sum;
+      sum += data[i];
+    }
+    report("Exclusive scan", passed);
+  }
+
+  // Stream compaction
+  {
+    std::vector<uint32_t> values(count);
+    std::iota(values.begin(), values.end(), 0);
+
+    auto outputBuffer = ShaderStorageBuffer::create();
+    auto countBuffer = ShaderStorageBuffer::create();
+    keyBuffer->bind().setData(values);
+    valueBuffer->bind().setData(flags);
+    outputBuffer->bind().reserve(count * sizeof(uint32_t), GL_DYNAMIC_DRAW);
+    countBuffer->bind().reserve(sizeof(uint32_t), GL_DYNAMIC_DRAW);
+    compact(keyBuffer, valueBuffer, count, outputBuffer, countBuffer);
+
+    std::vector<uint32_t> expected;
+    for (uint32_t i = 0; i < count; i++) {
+      if (flags[i]) {
+        expected.push_back(values[i]);
+      }
+    }
+
+    auto gpuCount = readBuffer<uint32_t>(countBuffer, 1)[0];
+    auto gpuValues = readBuffer<uint32_t>(outputBuffer, gpuCount);
+    report("Stream compaction", gpuCount == expected.size() && gpuValues == expected);
+  }
+
+  // Min/max reduction
+  {
+    std::vector<glm::vec4> data(count);
+    glm::vec4 expectedMin(std::numeric_limits<float>::max());
+    glm::vec4 expectedMax(-std::numeric_limits<float>::max());
+    for (auto& val : data) {
+      val = glm::vec4(floatDist(rng), floatDist(rng), floatDist(rng), floatDist(rng));
+      expectedMin = glm::min(expectedMin, val);
+      expectedMax = glm::max(expectedMax, val);
+    }
+
+    auto resultBuffer = ShaderStorageBuffer::create();
+    keyBuffer->bind().setData(data);
+    resultBuffer->bind().reserve(2 * sizeof(glm::vec4), GL_DYNAMIC_DRAW);
+    reduceMinMax(keyBuffer, count, resultBuffer);
+
+    auto gpuResult = readBuffer<glm::vec4>(resultBuffer, 2);
+    report("Min/max reduction", gpuResult[0] == expectedMin && gpuResult[1] == expectedMax);
+  }
+
+  m_lastVerifyResult = log.str();
+  glow::info() << "GPU primitives verification (" << count << " elements):\n" << m_lastVerifyResult;
+  return allPassed;
+}
+
+void GpuPrimitives::benchmark(uint32_t count, int iterations) {
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<uint32_t> keyDist;
+
+  std::vector<uint32_t> keys(count);
+  std::vector<uint32_t> values(count);
+  std::vector<uint32_t> flags(count);
+  std::vector<glm::vec4> points(count);
+  for (uint32_t i = 0; i < count; i++) {
+    keys[i] = keyDist(rng);
+    values[i] = i;
+    flags[i] = keys[i] & 1;
+    points[i] = glm::vec4((float)(keys[i] & 0xFFFF), (float)(keys[i] >> 16), (float)i, 1.0f);
+  }
+
+  auto keyBuffer = ShaderStorageBuffer::create();
+  auto valueBuffer = ShaderStorageBuffer::create();
+  auto flagBuffer = ShaderStorageBuffer::create();
+  auto pointBuffer = ShaderStorageBuffer::create();
+  auto outputBuffer = ShaderStorageBuffer::create();
+  auto countBuffer = ShaderStorageBuffer::create();
+  auto resultBuffer = ShaderStorageBuffer::create();
+  flagBuffer->bind().setData(flags);
+  pointBuffer->bind().setData(points);
+  outputBuffer->bind().reserve(count * sizeof(uint32_t), GL_DYNAMIC_DRAW);
+  countBuffer->bind().reserve(sizeof(uint32_t), GL_DYNAMIC_DRAW);
+  resultBuffer->bind().reserve(2 * sizeof(glm::vec4), GL_DYNAMIC_DRAW);
+
+  GLuint query;
+  glGenQueries(1, &query);
+
+  // Average GPU time in milliseconds; the setup callback is not timed
+  auto measure = [&](std::function<void()> setup, std::function<void()> op) {
+    GLuint64 total = 0;
+    for (int i = 0; i < iterations; i++) {
+      setup();
+      glBeginQuery(GL_TIME_ELAPSED, query);
+      op();
+      glEndQuery(GL_TIME_ELAPSED);
+
+      GLuint64 elapsed = 0;
+      glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+      total += elapsed;
+    }
+    return total / (double)iterations / 1e6;
+  };
+
+  auto resetKeys = [&]() {
+    keyBuffer->bind().setData(keys);
+    valueBuffer->bind().setData(values);
+  };
+
+  double sortTime = measure(resetKeys, [&]() { sortKeyValue(keyBuffer, valueBuffer, count); });
+  double scanTime = measure(resetKeys, [&]() { exclusiveScan(keyBuffer, count); });
+  double compactTime = measure([]() {}, [&]() { compact(valueBuffer, flagBuffer, count, outputBuffer, countBuffer); });
+  double reduceTime = measure([]() {}, [&]() { reduceMinMax(pointBuffer, count, resultBuffer); });
+
+  glDeleteQueries(1, &query);
+
+  auto throughput = [&](double ms) { return count / (ms * 1e3); };
+
+  std::stringstream log;
+  log.precision(3);
+  log << std::fixed;
+  log << "Radix sort:        " << sortTime << " ms (" << throughput(sortTime) << " Mkeys/s)\n";
+  log << "Exclusive scan:    " << scanTime << " ms (" << throughput(scanTime) << " M/s)\n";
+  log << "Stream compaction: " << compactTime << " ms (" << throughput(compactTime) << " M/s)\n";
+  log << "Min/max reduction: " << reduceTime << " ms (" << throughput(reduceTime) << " M/s)\n";
+
+  m_lastBenchmarkResult = log.str();
+  glow::info() << "GPU primitives benchmark (" << count << " elements):\n" << m_lastBenchmarkResult;
+}
+
+void GpuPrimitives::drawUI() {
+  if (!ImGui::CollapsingHeader("GPU Primitives")) {
+    return;
+  }
+
+  static int elementCount = 1 << 20;
+  ImGui::InputInt("Elements", &elementCount);
+  elementCount = std::max(1, elementCount);
+
+  if (ImGui::Button("Verify")) {
+    verify((uint32_t)elementCount);
+  }
+  ImGui::SameLine();
+  if (ImGui::Button("Benchmark")) {
+    benchmark((uint32_t)elementCount);
+  }
+
+  if (!m_lastVerifyResult.empty()) {
+    ImGui::TextUnformatted(m_lastVerifyResult.c_str());
+  }
+  if (!m_lastBenchmarkResult.empty()) {
+    ImGui::TextUnformatted(m_lastBenchmarkResult.c_str());
+  }
+}
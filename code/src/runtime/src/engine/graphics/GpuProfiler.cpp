@@ -0,0 +1,293 @@
+#include <engine/graphics/GpuProfiler.hpp>
+#include <engine/ui/imgui.h>
+#include <glow/common/log.hh>
+
+#define PICOJSON_USE_INT64
+#include <engine/utils/picojson.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+
+// Marks scopes begun outside of a frame, their end() is ignored
+static const size_t NO_STAGE = SIZE_MAX;
+
+void GpuProfiler::create() {
+  m_stages.reserve(64);
+  m_created = true;
+}
+
+void GpuProfiler::destroy() {
+  for (auto& frame : m_frames) {
+    if (!frame.queries.empty()) {
+      glDeleteQueries((GLsizei)frame.queries.size(), frame.queries.data());
+    }
+    frame.queries.clear();
+    frame.scopes.clear();
+    frame.usedQueries = 0;
+    frame.pending = false;
+  }
+  m_created = false;
+}
+
+size_t GpuProfiler::stageFor(const std::string& name) {
+  std::string path = name;
+  int depth = 0;
+  for (auto it = m_openScopes.rbegin(); it != m_openScopes.rend(); ++it) {
+    if (it->stage != NO_STAGE) {
+      path = m_stages[it->stage].path + "/" + name;
+      depth = m_stages[it->stage].depth + 1;
+      break;
+    }
+  }
+
+  auto found = m_stageIds.find(path);
+  if (found != m_stageIds.end()) {
+    return found->second;
+  }
+
+  Stage stage;
+  stage.path = path;
+  stage.name = name;
+  stage.depth = depth;
+  stage.history.resize(HISTORY_LENGTH, 0.0f);
+  stage.next = 0;
+  stage.count = 0;
+  stage.last = 0;
+  m_stages.push_back(stage);
+  m_stageIds[path] = m_stages.size() - 1;
+  return m_stages.size() - 1;
+}
+
+size_t GpuProfiler::timestamp() {
+  auto& frame = m_frames[m_frame];
+  if (!m_created) {
+    return 0;
+  }
+
+  if (frame.usedQueries == frame.queries.size()) {
+    size_t grow = std::max<size_t>(frame.queries.size(), 16);
+    frame.queries.resize(frame.queries.size() + grow);
+    glGenQueries((GLsizei)grow, frame.queries.data() + frame.usedQueries);
+  }
+
+  glQueryCounter(frame.queries[frame.usedQueries], GL_TIMESTAMP);
+  return frame.usedQueries++;
+}
+
+bool GpuProfiler::resolve(Frame& frame) {
+  // The last query is issued last, but drivers don't promise to complete
+  // them in order
+  for (size_t i = 0; i < frame.usedQueries; i++) {
+    GLint available = 0;
+    glGetQueryObjectiv(frame.queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+      return false;
+    }
+  }
+
+  std::vector<float> durations(m_stages.size(), -1.0f);
+  for (auto& scope : frame.scopes) {
+    GLuint64 begin = 0, end = 0;
+    glGetQueryObjectui64v(frame.queries[scope.beginQuery], GL_QUERY_RESULT, &begin);
+    glGetQueryObjectui64v(frame.queries[scope.endQuery], GL_QUERY_RESULT, &end);
+
+    float ms = end > begin ? (float)((end - begin) / 1e6) : 0.0f;
+    durations[scope.stage] = std::max(durations[scope.stage], 0.0f) + ms;
+  }
+
+  for (size_t i = 0; i < m_stages.size(); i++) {
+    if (durations[i] < 0) {
+      continue;
+    }
+
+    auto& stage = m_stages[i];
+    stage.last = durations[i];
+    stage.history[stage.next] = durations[i];
+    stage.next = (stage.next + 1) % HISTORY_LENGTH;
+    stage.count++;
+  }
+  return true;
+}
+
+bool GpuProfiler::beginFrame() {
+  auto& frame = m_frames[m_frame];
+
+  bool resolved = false;
+  if (frame.pending) {
+    resolved = resolve(frame);
+    if (!resolved) {
+      m_droppedFrames++;
+    }
+  }
+
+  frame.usedQueries = 0;
+  frame.scopes.clear();
+  frame.pending = false;
+  m_openScopes.clear();
+  m_inFrame = true;
+  return resolved;
+}
+
+void GpuProfiler::endFrame() {
+  if (!m_inFrame) {
+    return;
+  }
+
+  auto& frame = m_frames[m_frame];
+  frame.pending = frame.usedQueries > 0;
+  m_inFrame = false;
+  m_frame = (m_frame + 1) % FRAMES_IN_FLIGHT;
+}
+
+void GpuProfiler::begin(const std::string& name) {
+  if (!m_inFrame) {
+    m_openScopes.push_back({ NO_STAGE, 0 });
+    return;
+  }
+
+  size_t stage = stageFor(name);
+  size_t query = timestamp();
+  m_frames[m_frame].scopes.push_back({ stage, query, query });
+  m_openScopes.push_back({ stage, m_frames[m_frame].scopes.size() - 1 });
+}
+
+void GpuProfiler::end() {
+  if (m_openScopes.empty()) {
+    glow::error() << "GpuProfiler::end() without a scope\n";
+    return;
+  }
+
+  auto open = m_openScopes.back();
+  m_openScopes.pop_back();
+  if (open.stage == NO_STAGE || !m_inFrame) {
+    return;
+  }
+
+  m_frames[m_frame].scopes[open.scope].endQuery = timestamp();
+}
+
+bool GpuProfiler::lastTime(const std::string& path, float& ms) const {
+  auto found = m_stageIds.find(path);
+  if (found == m_stageIds.end() || m_stages[found->second].count == 0) {
+    return false;
+  }
+
+  ms = m_stages[found->second].last;
+  return true;
+}
+
+GpuProfiler::Statistics GpuProfiler::statistics(size_t stage) const {
+  Statistics result;
+  auto& s = m_stages[stage];
+  result.samples = std::min<size_t>(s.count, HISTORY_LENGTH);
+  if (result.samples == 0) {
+    return result;
+  }
+
+  std::vector<float> sorted(result.samples);
+  for (size_t i = 0; i < result.samples; i++) {
+    sorted[i] = s.history[(s.next + HISTORY_LENGTH - 1 - i) % HISTORY_LENGTH];
+  }
+  std::sort(sorted.begin(), sorted.end());
+
+  float sum = 0;
+  for (float ms : sorted) {
+    sum += ms;
+  }
+
+  result.last = s.last;
+  result.min = sorted.front();
+  result.avg = sum / result.samples;
+  result.p99 = sorted[std::min(result.samples - 1, (size_t)(result.samples * 0.99f))];
+  return result;
+}
+
+void GpuProfiler::drawUI() {
+  ImGui::Begin("GPU Profiler");
+
+  ImGui::Columns(5, "GpuProfilerStages");
+  ImGui::Text("Stage");
+  ImGui::NextColumn();
+  ImGui::Text("Last ms");
+  ImGui::NextColumn();
+  ImGui::Text("Min ms");
+  ImGui::NextColumn();
+  ImGui::Text("Avg ms");
+  ImGui::NextColumn();
+  ImGui::Text("P99 ms");
+  ImGui::NextColumn();
+  ImGui::Separator();
+
+  for (size_t i = 0; i < m_stages.size(); i++) {
+    auto s = statistics(i);
+    ImGui::Text("%*s%s", m_stages[i].depth * 2, "", m_stages[i].name.c_str());
+    ImGui::NextColumn();
+    ImGui::Text("%.3f", s.last);
+    ImGui::NextColumn();
+    ImGui::Text("%.3f", s.min);
+    ImGui::NextColumn();
+    ImGui::Text("%.3f", s.avg);
+    ImGui::NextColumn();
+    ImGui::Text("%.3f", s.p99);
+    ImGui::NextColumn();
+  }
+  ImGui::Columns(1);
+  ImGui::Separator();
+
+  ImGui::Text("%d frames dropped waiting for results", (int)m_droppedFrames);
+  if (ImGui::Button("Export CSV")) {
+    exportCSV("gpu_profile.csv");
+  }
+  ImGui::SameLine();
+  if (ImGui::Button("Export JSON")) {
+    exportJSON("gpu_profile.json");
+  }
+
+  ImGui::End();
+}
+
+bool GpuProfiler::exportCSV(const std::string& path) const {
+  std::ofstream file(path);
+  if (!file) {
+    glow::error() << "Could not write GPU profile " << path << "\n";
+    return false;
+  }
+
+  file << "stage,depth,last_ms,min_ms,avg_ms,p99_ms,samples\n";
+  for (size_t i = 0; i < m_stages.size(); i++) {
+    auto s = statistics(i);
+    file << m_stages[i].path << "," << m_stages[i].depth << "," << s.last << "," << s.min << "," << s.avg << ","
+         << s.p99 << "," << s.samples << "\n";
+  }
+
+  glow::info() << "Wrote GPU profile " << path << "\n";
+  return true;
+}
+
+bool GpuProfiler::exportJSON(const std::string& path) const {
+  std::ofstream file(path);
+  if (!file) {
+    glow::error() << "Could not write GPU profile " << path << "\n";
+    return false;
+  }
+
+  picojson::array stages;
+  for (size_t i = 0; i < m_stages.size(); i++) {
+    auto s = statistics(i);
+    picojson::object stage;
+    stage["stage"] = picojson::value(m_stages[i].path);
+    stage["depth"] = picojson::value((int64_t)m_stages[i].depth);
+    stage["last_ms"] = picojson::value((double)s.last);
+    stage["min_ms"] = picojson::value((double)s.min);
+    stage["avg_ms"] = picojson::value((double)s.avg);
+    stage["p99_ms"] = picojson::value((double)s.p99);
+    stage["samples"] = picojson::value((int64_t)s.samples);
+    stages.push_back(picojson::value(stage));
+  }
+
+  file << picojson::value(stages).serialize(true);
+
+  glow::info() << "Wrote GPU profile " << path << "\n";
+  return true;
+}
@@ -0,0 +1,50 @@
+#include <engine/graphics/GrowableBuffer.hpp>
+#include <glow/objects/ShaderStorageBuffer.hh>
+#include <glow/common/log.hh>
+
+#include <algorithm>
+
+using namespace glow;
+
+void GrowableBuffer::create(size_t elementSize, size_t initialCapacity) {
+  m_buffer = ShaderStorageBuffer::create();
+  m_elementSize = elementSize;
+  m_capacity = std::max<size_t>(initialCapacity, 1);
+  m_count = 0;
+
+  GLint64 maxBlockSize = 0;
+  glGetInteger64v(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &maxBlockSize);
+  m_maxCount = (size_t)maxBlockSize / m_elementSize;
+
+  auto boundBuffer = m_buffer->bind();
+  boundBuffer.reserve(m_capacity * m_elementSize, GL_DYNAMIC_DRAW);
+}
+
+bool GrowableBuffer::resize(size_t count) {
+  if (count > m_maxCount) {
+    error() << "GrowableBuffer: " << count << " elements requested, the device allows " << m_maxCount;
+    count = m_maxCount;
+  }
+
+  m_count = count;
+  if (count <= m_capacity) {
+    return false;
+  }
+
+  // Reserving the same buffer object keeps every program binding valid
+  m_capacity = std::min(std::max(count, m_capacity + m_capacity / 2), m_maxCount);
+  auto boundBuffer = m_buffer->bind();
+  boundBuffer.reserve(m_capacity * m_elementSize, GL_DYNAMIC_DRAW);
+  m_reallocations++;
+  return true;
+}
+
+void GrowableBuffer::upload(const void* data, size_t bytes) {
+  bytes = std::min(bytes, bytesUsed());
+  if (bytes == 0) {
+    return;
+  }
+
+  auto boundBuffer = m_buffer->bind();
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bytes, data);
+}
@@ -0,0 +1,421 @@
+#include <engine/graphics/IrradianceVolume.hpp>
+#include <glow/common/log.hh>
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <thread>
+
+static const float PI = 3.14159265359f;
+static const float RAY_EPSILON = 1e-3f;
+static const uint32_t BVH_LEAF_SIZE = 4;
+
+// Probes that see more back faces than this are assumed to be inside geometry
+static const float MAX_BACKFACE_RATIO = 0.25f;
+
+static const char VOLUME_MAGIC[4] = { 'O', 'I', 'R', 'V' };
+static const uint32_t VOLUME_VERSION = 1;
+
+// Anything larger in a file is corrupt, the bake stays far below it
+static const int32_t MAX_FILE_PROBES_PER_AXIS = 1024;
+
+struct VolumeHeader {
+  char magic[4];
+  uint32_t version;
+  int32_t resolution[3];
+  float boundsMin[3];
+  float boundsMax[3];
+};
+
+// Interior nodes have a count of 0, their left child follows them directly
+// and start holds the index of the right one
+struct BvhNode {
+  glm::vec3 boundsMin;
+  uint32_t start;
+  glm::vec3 boundsMax;
+  uint32_t count;
+};
+
+struct RayHit {
+  float t;
+  uint32_t triangle;
+};
+
+class Bvh {
+private:
+  std::vector<BvhNode> m_nodes;
+  std::vector<BakeTriangle> m_triangles;
+
+  uint32_t buildNode(uint32_t begin, uint32_t end) {
+    uint32_t index = (uint32_t)m_nodes.size();
+    m_nodes.push_back(BvhNode());
+
+    glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+    glm::vec3 centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+    for (uint32_t i = begin; i < end; i++) {
+      auto& tri = m_triangles[i];
+      boundsMin = glm::min(boundsMin, glm::min(tri.a, glm::min(tri.b, tri.c)));
+      boundsMax = glm::max(boundsMax, glm::max(tri.a, glm::max(tri.b, tri.c)));
+
+      auto centroid = (tri.a + tri.b + tri.c) / 3.0f;
+      centroidMin = glm::min(centroidMin, centroid);
+      centroidMax = glm::max(centroidMax, centroid);
+    }
+
+    m_nodes[index].boundsMin = boundsMin;
+    m_nodes[index].boundsMax = boundsMax;
+
+    if (end - begin <= BVH_LEAF_SIZE) {
+      m_nodes[index].start = begin;
+      m_nodes[index].count = end - begin;
+      return index;
+    }
+
+    // Median split along the widest centroid axis
+    auto extent = centroidMax - centroidMin;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    uint32_t mid = (begin + end) / 2;
+    std::nth_element(m_triangles.begin() + begin, m_triangles.begin() + mid, m_triangles.begin() + end,
+                     [axis](const BakeTriangle& a, const BakeTriangle& b) {
+                       return a.a[axis] + a.b[axis] + a.c[axis] < b.a[axis] + b.b[axis] + b.c[axis];
+                     });
+
+    buildNode(begin, mid);
+    uint32_t right = buildNode(mid, end);
+    m_nodes[index].start = right;
+    m_nodes[index].count = 0;
+    return index;
+  }
+
+  static bool intersectBounds(const BvhNode& node, glm::vec3 origin, glm::vec3 invDir, float maxT) {
+    auto t0 = (node.boundsMin - origin) * invDir;
+    auto t1 = (node.boundsMax - origin) * invDir;
+    auto tMin = glm::min(t0, t1);
+    auto tMax = glm::max(t0, t1);
+    float enter = std::max(std::max(tMin.x, tMin.y), std::max(tMin.z, 0.0f));
+    float exit = std::min(std::min(tMax.x, tMax.y), std::min(tMax.z, maxT));
+    return enter <= exit;
+  }
+
+  // Moeller-Trumbore, both sides of the triangle count as a hit
+  static bool intersectTriangle(const BakeTriangle& tri, glm::vec3 origin, glm::vec3 dir, float& t) {
+    auto e1 = tri.b - tri.a;
+    auto e2 = tri.c - tri.a;
+    auto p = glm::cross(dir, e2);
+    float det = glm::dot(e1, p);
+    if (std::abs(det) < 1e-10f) {
+      return false;
+    }
+
+    float invDet = 1.0f / det;
+    auto s = origin - tri.a;
+    float u = glm::dot(s, p) * invDet;
+    if (u < 0.0f || u > 1.0f) {
+      return false;
+    }
+
+    auto q = glm::cross(s, e1);
+    float v = glm::dot(dir, q) * invDet;
+    if (v < 0.0f || u + v > 1.0f) {
+      return false;
+    }
+
+    t = glm::dot(e2, q) * invDet;
+    return t > RAY_EPSILON;
+  }
+
+public:
+  explicit Bvh(const std::vector<BakeTriangle>& triangles) : m_triangles(triangles) {
+    if (!m_triangles.empty()) {
+      buildNode(0, (uint32_t)m_triangles.size());
+    }
+  }
+
+  const BakeTriangle& triangle(uint32_t index) const { return m_triangles[index]; }
+
+  // With anyHit set the traversal stops at the first hit, for shadow rays
+  bool intersect(glm::vec3 origin, glm::vec3 dir, float maxT, RayHit& hit, bool anyHit = false) const {
+    if (m_nodes.empty()) {
+      return false;
+    }
+
+    auto invDir = 1.0f / dir;
+    hit.t = maxT;
+    bool found = false;
+
+    uint32_t stack[64];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0) {
+      auto& node = m_nodes[stack[--stackSize]];
+      if (!intersectBounds(node, origin, invDir, hit.t)) {
+        continue;
+      }
+
+      if (node.count == 0) {
+        stack[stackSize++] = node.start;
+        stack[stackSize++] = (uint32_t)(&node - m_nodes.data()) + 1;
+        continue;
+      }
+
+      for (uint32_t i = node.start; i < node.start + node.count; i++) {
+        float t;
+        if (intersectTriangle(m_triangles[i], origin, dir, t) && t < hit.t) {
+          hit.t = t;
+          hit.triangle = i;
+          found = true;
+          if (anyHit) {
+            return true;
+          }
+        }
+      }
+    }
+
+    return found;
+  }
+};
+
+struct BakeContext {
+  const Bvh* bvh;
+  const std::vector<BakeMaterial>* materials;
+  const std::vector<BakeLight>* lights;
+};
+
+static glm::vec3 uniformSphere(std::mt19937& rng) {
+  std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+  float z = 1.0f - 2.0f * uniform(rng);
+  float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+  float phi = 2.0f * PI * uniform(rng);
+  return glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+static glm::vec3 cosineHemisphere(glm::vec3 n, std::mt19937& rng) {
+  // Normalized sum of the normal and a point on the unit sphere is cosine distributed
+  auto dir = n + uniformSphere(rng);
+  float len = glm::length(dir);
+  return len > 1e-6f ? dir / len : n;
+}
+
+// Outgoing radiance towards the ray origin. Direct light is the average over
+// the lights, like directIllumination in RaycastCompute which picks one light
+// per vertex without scaling by the light count.
+static glm::vec3 traceRadiance(const BakeContext& ctx, glm::vec3 origin, glm::vec3 dir, int bounces,
+                               std::mt19937& rng, bool* backface = nullptr) {
+  RayHit hit;
+  if (!ctx.bvh->intersect(origin, dir, FLT_MAX, hit)) {
+    return glm::vec3(0);
+  }
+
+  auto& tri = ctx.bvh->triangle(hit.triangle);
+  auto& material = (*ctx.materials)[tri.material];
+
+  auto n = glm::normalize(glm::cross(tri.b - tri.a, tri.c - tri.a));
+  if (glm::dot(n, dir) > 0) {
+    n = -n;
+    if (backface) {
+      *backface = true;
+    }
+  }
+
+  auto pos = origin + dir * hit.t + n * RAY_EPSILON;
+  auto radiance = material.emissiveColor * std::max(0.0f, glm::dot(n, -dir));
+
+  auto& lights = *ctx.lights;
+  if (!lights.empty()) {
+    glm::vec3 direct(0);
+    for (auto& light : lights) {
+      auto toLight = light.pos + uniformSphere(rng) * light.radius - pos;
+      float dist = glm::length(toLight);
+      toLight /= dist;
+
+      float cosTheta = glm::dot(n, toLight);
+      RayHit shadowHit;
+      if (cosTheta <= 0 || ctx.bvh->intersect(pos, toLight, dist, shadowHit, true)) {
+        continue;
+      }
+      direct += cosTheta * light.radiance / (dist * dist);
+    }
+    radiance += material.diffuseColor * direct / (float)lights.size();
+  }
+
+  if (bounces > 0) {
+    radiance += material.diffuseColor * traceRadiance(ctx, pos, cosineHemisphere(n, rng), bounces - 1, rng);
+  }
+
+  return radiance;
+}
+
+IrradianceVolume IrradianceVolume::bake(const std::vector<BakeTriangle>& triangles,
+                                        const std::vector<BakeMaterial>& materials,
+                                        const std::vector<BakeLight>& lights,
+                                        const IrradianceBakeSettings& settings) {
+  IrradianceVolume volume;
+  if (triangles.empty()) {
+    return volume;
+  }
+
+  volume.boundsMin = glm::vec3(FLT_MAX);
+  volume.boundsMax = glm::vec3(-FLT_MAX);
+  for (auto& tri : triangles) {
+    volume.boundsMin = glm::min(volume.boundsMin, glm::min(tri.a, glm::min(tri.b, tri.c)));
+    volume.boundsMax = glm::max(volume.boundsMax, glm::max(tri.a, glm::max(tri.b, tri.c)));
+  }
+
+  auto extent = volume.boundsMax - volume.boundsMin;
+  auto probesPerAxis = glm::ceil(extent / std::max(settings.probeSpacing, 1e-3f)) + 1.0f;
+  volume.resolution = glm::clamp(glm::ivec3(probesPerAxis), glm::ivec3(2), glm::ivec3(std::max(2, settings.maxProbesPerAxis)));
+  volume.probes.resize(volume.probeCount() * VEC4S_PER_PROBE);
+
+  Bvh bvh(triangles);
+  BakeContext ctx = { &bvh, &materials, &lights };
+
+  int probeCount = (int)volume.probeCount();
+  int rayCount = std::max(1, settings.raysPerProbe);
+  auto resolution = volume.resolution;
+
+  auto bakeProbe = [&](int index) {
+    glm::ivec3 cell(index % resolution.x, (index / resolution.x) % resolution.y, index / (resolution.x * resolution.y));
+    auto pos = volume.boundsMin + extent * glm::vec3(cell) / glm::vec3(resolution - 1);
+
+    std::mt19937 rng((uint32_t)index * 9781u + 1u);
+    glm::vec4 sh[3] = { glm::vec4(0), glm::vec4(0), glm::vec4(0) };
+    int backfaces = 0;
+
+    for (int i = 0; i < rayCount; i++) {
+      auto dir = uniformSphere(rng);
+      bool backface = false;
+      auto radiance = traceRadiance(ctx, pos, dir, settings.bounces, rng, &backface);
+      backfaces += backface ? 1 : 0;
+
+      // L1 basis, ordered (L00, L1-1, L10, L11)
+      glm::vec4 basis(0.282095f, 0.488603f * dir.y, 0.488603f * dir.z, 0.488603f * dir.x);
+      for (int c = 0; c < 3; c++) {
+        sh[c] += basis * radiance[c];
+      }
+    }
+
+    auto* probe = &volume.probes[(size_t)index * VEC4S_PER_PROBE];
+    for (int c = 0; c < 3; c++) {
+      probe[c] = sh[c] * (4.0f * PI / rayCount);
+    }
+    probe[3] = glm::vec4(backfaces <= MAX_BACKFACE_RATIO * rayCount ? 1.0f : 0.0f, 0, 0, 0);
+  };
+
+  int threadCount = settings.threadCount > 0 ? settings.threadCount : (int)std::thread::hardware_concurrency();
+  threadCount = std::max(1, std::min(threadCount, probeCount));
+
+  std::atomic<int> nextProbe(0);
+  auto worker = [&]() {
+    for (int probe = nextProbe++; probe < probeCount; probe = nextProbe++) {
+      bakeProbe(probe);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int i = 1; i < threadCount; i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  glow::info() << "Baked " << probeCount << " irradiance probes from " << triangles.size() << " triangles\n";
+  return volume;
+}
+
+bool IrradianceVolume::save(const std::string& path) const {
+  std::ofstream file(path, std::ios::binary);
+  if (!file) {
+    glow::error() << "Could not write irradiance volume " << path << "\n";
+    return false;
+  }
+
+  VolumeHeader header;
+  memcpy(header.magic, VOLUME_MAGIC, sizeof(VOLUME_MAGIC));
+  header.version = VOLUME_VERSION;
+  for (int i = 0; i < 3; i++) {
+    header.resolution[i] = resolution[i];
+    header.boundsMin[i] = boundsMin[i];
+    header.boundsMax[i] = boundsMax[i];
+  }
+  file.write((const char*)&header, sizeof(header));
+
+  std::vector<uint16_t> halves(probes.size() * 4);
+  for (size_t i = 0; i < probes.size(); i++) {
+    for (int c = 0; c < 4; c++) {
+      halves[i * 4 + c] = glm::packHalf1x16(probes[i][c]);
+    }
+  }
+  file.write((const char*)halves.data(), halves.size() * sizeof(uint16_t));
+
+  return (bool)file;
+}
+
+bool IrradianceVolume::load(const std::string& path) {
+  // A failed load leaves an empty volume behind
+  resolution = glm::ivec3(0);
+  boundsMin = glm::vec3(0);
+  boundsMax = glm::vec3(0);
+  probes.clear();
+
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+
+  file.seekg(0, std::ios::end);
+  auto fileSize = (size_t)file.tellg();
+  file.seekg(0, std::ios::beg);
+
+  VolumeHeader header;
+  file.read((char*)&header, sizeof(header));
+  if (!file || memcmp(header.magic, VOLUME_MAGIC, sizeof(VOLUME_MAGIC)) != 0 || header.version != VOLUME_VERSION) {
+    glow::error() << path << " is not an irradiance volume\n";
+    return false;
+  }
+
+  for (int i = 0; i < 3; i++) {
+    if (header.resolution[i] < 2 || header.resolution[i] > MAX_FILE_PROBES_PER_AXIS) {
+      glow::error() << "Irradiance volume " << path << " has an invalid resolution\n";
+      return false;
+    }
+  }
+
+  // Checked against the file before anything is allocated
+  size_t fileProbeCount = (size_t)header.resolution[0] * header.resolution[1] * header.resolution[2];
+  size_t halfCount = fileProbeCount * VEC4S_PER_PROBE * 4;
+  if (fileSize != sizeof(header) + halfCount * sizeof(uint16_t)) {
+    glow::error() << "Irradiance volume " << path << " doesn't match its resolution\n";
+    return false;
+  }
+
+  std::vector<uint16_t> halves(halfCount);
+  file.read((char*)halves.data(), halves.size() * sizeof(uint16_t));
+  if (!file) {
+    glow::error() << "Irradiance volume " << path << " is truncated\n";
+    return false;
+  }
+
+  for (int i = 0; i < 3; i++) {
+    resolution[i] = header.resolution[i];
+    boundsMin[i] = header.boundsMin[i];
+    boundsMax[i] = header.boundsMax[i];
+  }
+
+  probes.resize(probeCount() * VEC4S_PER_PROBE);
+  for (size_t i = 0; i < probes.size(); i++) {
+    for (int c = 0; c < 4; c++) {
+      probes[i][c] = glm::unpackHalf1x16(halves[i * 4 + c]);
+    }
+  }
+
+  return true;
+}
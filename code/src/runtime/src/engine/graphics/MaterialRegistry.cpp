@@ -0,0 +1,94 @@
+#include <engine/graphics/MaterialRegistry.hpp>
+#include <engine/graphics/TextureTable.hpp>
+#include <glow/objects/ShaderStorageBuffer.hh>
+
+#include <algorithm>
+
+using namespace glow;
+
+// Keep in sync with Material in PrimitiveCommon.glsl
+struct GPUMaterial {
+    glm::vec3 diffuseColor;
+    float roughness;
+    glm::vec3 emissiveColor;
+    float refractiveness;
+    glm::vec3 specularColor;
+    float eta;
+    glm::uint diffuseTexId;
+    glm::uint specularTexId;
+    glm::uint emissiveTexId;
+    glm::uint normalTexId;
+};
+
+static bool isTextured(const Material& mat) {
+  return mat.diffuseTexture || mat.specularTexture || mat.emissiveTexture || mat.normalsTexture;
+}
+
+void MaterialRegistry::create() {
+  m_buffer.create(sizeof(GPUMaterial), 256);
+}
+
+MaterialHandle MaterialRegistry::add(const Material& material) {
+  auto handle = (MaterialHandle)m_materials.size();
+  m_materials.push_back(material);
+  m_textured.push_back(false);
+  markDirty(handle);
+  return handle;
+}
+
+Material& MaterialRegistry::edit(MaterialHandle handle) {
+  markDirty(handle);
+  return m_materials[handle];
+}
+
+void MaterialRegistry::set(MaterialHandle handle, const Material& material) {
+  m_materials[handle] = material;
+  markDirty(handle);
+}
+
+void MaterialRegistry::markDirty(MaterialHandle handle) {
+  if (m_dirtyBegin == m_dirtyEnd) {
+    m_dirtyBegin = handle;
+    m_dirtyEnd = handle + 1;
+  } else {
+    m_dirtyBegin = std::min<size_t>(m_dirtyBegin, handle);
+    m_dirtyEnd = std::max<size_t>(m_dirtyEnd, handle + 1);
+  }
+}
+
+void MaterialRegistry::update(TextureTable& textures) {
+  if (m_dirtyBegin == m_dirtyEnd) {
+    return;
+  }
+
+  // Growing loses the contents, the whole table is written again
+  if (m_buffer.resize(m_materials.size())) {
+    m_dirtyBegin = 0;
+    m_dirtyEnd = m_materials.size();
+  }
+
+  std::vector<GPUMaterial> range;
+  range.reserve(m_dirtyEnd - m_dirtyBegin);
+  for (size_t i = m_dirtyBegin; i < m_dirtyEnd; i++) {
+    auto& mat = m_materials[i];
+    range.push_back({
+        mat.diffuseColor, mat.roughness, mat.emissiveColor,
+        mat.refractiveness, mat.specularColor, mat.eta,
+        textures.indexOf(mat.diffuseTexture), textures.indexOf(mat.specularTexture),
+        textures.indexOf(mat.emissiveTexture), textures.indexOf(mat.normalsTexture) });
+
+    bool textured = isTextured(mat);
+    if (textured != m_textured[i]) {
+      m_texturedCount += textured ? 1 : -1;
+      m_textured[i] = textured;
+    }
+  }
+
+  {
+    auto boundBuffer = m_buffer.buffer()->bind();
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, m_dirtyBegin * sizeof(GPUMaterial),
+                    range.size() * sizeof(GPUMaterial), range.data());
+  }
+
+  m_dirtyBegin = m_dirtyEnd = 0;
+}
@@ -0,0 +1,10 @@
+#include <engine/graphics/PostFX.hpp>
+#include <engine/graphics/RenderGraph.hpp>
+
+void PostFX::declare(RenderGraph& graph, RenderGraphTexture input, RenderGraphTexture output) {
+  graph.addPass(name(), { { input, RenderGraphAccess::Sampled } },
+                { { output, RenderGraphAccess::RenderTarget } },
+                [this, input, output](RenderGraph& graph) {
+    apply(graph.getTexture(input), graph.getFramebuffer(output));
+  });
+}
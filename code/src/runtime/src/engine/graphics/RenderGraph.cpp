@@ -0,0 +1,236 @@
+#include <engine/graphics/RenderGraph.hpp>
+#include <engine/graphics/GpuProfiler.hpp>
+#include <engine/graphics/RendererSystem.hpp>
+#include <engine/utils/Remotery.h>
+#include <glow/objects/Framebuffer.hh>
+#include <glow/objects/Texture2D.hh>
+
+using namespace glow;
+
+static size_t bytesPerPixel(GLenum format) {
+  switch (format) {
+  case GL_RGBA32F:
+  case GL_RGBA32UI:
+    return 16;
+  case GL_RGBA16F:
+  case GL_RG32F:
+    return 8;
+  case GL_R16F:
+    return 2;
+  default:
+    return 4;
+  }
+}
+
+static size_t textureBytes(const SharedTexture2D& texture, GLenum format) {
+  return (size_t)texture->getWidth() * texture->getHeight() * bytesPerPixel(format);
+}
+
+void RenderGraph::create(RendererSystem* renderer, GpuProfiler* profiler) {
+  m_renderer = renderer;
+  m_profiler = profiler;
+}
+
+void RenderGraph::reset() {
+  m_textures.clear();
+  m_passes.clear();
+  m_compiled = false;
+
+  // Imported textures nobody else holds on to anymore were replaced
+  for (size_t i = 0; i < m_pool.size();) {
+    if (m_pool[i].imported && m_pool[i].texture.use_count() == 1) {
+      m_pool.erase(m_pool.begin() + i);
+    } else {
+      m_pool[i].lastPass = -1;
+      i++;
+    }
+  }
+}
+
+RenderGraphTexture RenderGraph::createTexture(const std::string& name, ScreenSpaceSize size, GLenum format) {
+  m_textures.push_back({ name, size, format, -1, -1, -1, false });
+  m_compiled = false;
+  return (RenderGraphTexture)m_textures.size() - 1;
+}
+
+RenderGraphTexture RenderGraph::importTexture(const std::string& name, SharedTexture2D texture) {
+  int pooled = findPooled(texture);
+  if (pooled < 0) {
+    m_pool.push_back({ ScreenSpaceSize::FULL, GL_NONE, texture, nullptr, -1, true, false, 0 });
+    pooled = (int)m_pool.size() - 1;
+  }
+
+  m_textures.push_back({ name, ScreenSpaceSize::FULL, m_pool[pooled].format, pooled, -1, -1, true });
+  return (RenderGraphTexture)m_textures.size() - 1;
+}
+
+void RenderGraph::addPass(const std::string& name, std::vector<RenderGraphUse> reads,
+                          std::vector<RenderGraphUse> writes, Execute execute) {
+  m_passes.push_back({ name, std::move(reads), std::move(writes), std::move(execute), 0 });
+  m_compiled = false;
+}
+
+int RenderGraph::findPooled(const SharedTexture2D& texture) const {
+  for (size_t i = 0; i < m_pool.size(); i++) {
+    if (m_pool[i].texture == texture) {
+      return (int)i;
+    }
+  }
+  return -1;
+}
+
+int RenderGraph::acquirePooled(ScreenSpaceSize size, GLenum format, int firstPass) {
+  for (size_t i = 0; i < m_pool.size(); i++) {
+    auto& pooled = m_pool[i];
+    if (!pooled.imported && pooled.size == size && pooled.format == format && pooled.lastPass < firstPass) {
+      return (int)i;
+    }
+  }
+
+  // Goes through the renderer so it follows window resizes
+  auto texture = m_renderer->createScreenspaceTexture(size, format);
+  m_pool.push_back({ size, format, texture, nullptr, -1, false, false, 0 });
+  return (int)m_pool.size() - 1;
+}
+
+GLbitfield RenderGraph::visibilityBarrier(PooledTexture& pooled, RenderGraphAccess access) {
+  if (!pooled.incoherent) {
+    return 0;
+  }
+
+  GLbitfield barrier = 0;
+  switch (access) {
+  case RenderGraphAccess::Sampled:
+    barrier = GL_TEXTURE_FETCH_BARRIER_BIT;
+    break;
+  case RenderGraphAccess::Image:
+    barrier = GL_SHADER_IMAGE_ACCESS_BARRIER_BIT;
+    break;
+  case RenderGraphAccess::RenderTarget:
+    barrier = GL_FRAMEBUFFER_BARRIER_BIT;
+    break;
+  case RenderGraphAccess::Copy:
+    barrier = GL_TEXTURE_UPDATE_BARRIER_BIT;
+    break;
+  }
+
+  // One barrier covers every later access of the same kind
+  barrier &= ~pooled.barriersIssued;
+  pooled.barriersIssued |= barrier;
+  return barrier;
+}
+
+void RenderGraph::compile() {
+  // Lifetimes in pass order
+  for (int i = 0; i < (int)m_passes.size(); i++) {
+    for (auto uses : { &m_passes[i].reads, &m_passes[i].writes }) {
+      for (auto& use : *uses) {
+        auto& texture = m_textures[use.texture];
+        if (texture.firstPass < 0) {
+          texture.firstPass = i;
+        }
+        texture.lastPass = i;
+      }
+    }
+  }
+
+  for (int i = 0; i < (int)m_passes.size(); i++) {
+    auto& pass = m_passes[i];
+
+    // Transients first used here take a pooled texture whose last
+    // occupant is done by now
+    for (auto& texture : m_textures) {
+      if (!texture.imported && texture.firstPass == i) {
+        texture.pooled = acquirePooled(texture.size, texture.format, i);
+        m_pool[texture.pooled].lastPass = texture.lastPass;
+
+        m_frameStatistics.transientCount++;
+        m_frameStatistics.transientBytes += textureBytes(m_pool[texture.pooled].texture, texture.format);
+      }
+    }
+
+    // The state is tracked per pooled texture, so an aliased transient
+    // also waits for image stores of the one before it
+    pass.barriers = 0;
+    for (auto uses : { &pass.reads, &pass.writes }) {
+      for (auto& use : *uses) {
+        pass.barriers |= visibilityBarrier(m_pool[m_textures[use.texture].pooled], use.access);
+      }
+    }
+
+    for (auto& use : pass.writes) {
+      auto& pooled = m_pool[m_textures[use.texture].pooled];
+      pooled.incoherent = use.access == RenderGraphAccess::Image;
+      pooled.barriersIssued = 0;
+    }
+
+    if (pass.barriers) {
+      m_frameStatistics.barrierCount++;
+    }
+  }
+
+  m_compiled = true;
+}
+
+void RenderGraph::execute() {
+  if (!m_compiled) {
+    compile();
+  }
+
+  for (auto& pass : m_passes) {
+    rmt_BeginCPUSampleDynamic(pass.name.c_str(), 0);
+    if (m_profiler) {
+      m_profiler->begin(pass.name);
+    }
+    if (pass.barriers) {
+      glMemoryBarrier(pass.barriers);
+    }
+    pass.execute(*this);
+    if (m_profiler) {
+      m_profiler->end();
+    }
+    rmt_EndCPUSample();
+  }
+}
+
+SharedTexture2D RenderGraph::getTexture(RenderGraphTexture texture) const {
+  if (texture < 0 || m_textures[texture].pooled < 0) {
+    return nullptr;
+  }
+  return m_pool[m_textures[texture].pooled].texture;
+}
+
+SharedFramebuffer RenderGraph::getFramebuffer(RenderGraphTexture texture) {
+  if (texture < 0 || m_textures[texture].pooled < 0) {
+    return nullptr;
+  }
+
+  auto& pooled = m_pool[m_textures[texture].pooled];
+  if (!pooled.framebuffer) {
+    pooled.framebuffer = Framebuffer::create({ { "oColor", pooled.texture } });
+  }
+  return pooled.framebuffer;
+}
+
+void RenderGraph::endFrame() {
+  m_lastFrameStatistics = m_frameStatistics;
+  m_frameStatistics = Statistics();
+}
+
+size_t RenderGraph::poolSize() const {
+  size_t count = 0;
+  for (auto& pooled : m_pool) {
+    count += pooled.imported ? 0 : 1;
+  }
+  return count;
+}
+
+size_t RenderGraph::poolBytes() const {
+  size_t bytes = 0;
+  for (auto& pooled : m_pool) {
+    if (!pooled.imported) {
+      bytes += textureBytes(pooled.texture, pooled.format);
+    }
+  }
+  return bytes;
+}
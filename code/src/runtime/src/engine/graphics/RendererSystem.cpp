@@ -1,14 +1,19 @@
 #include <engine/graphics/RendererSystem.hpp>
+#include <engine/graphics/ShaderSource.hpp>
 #include <glow/gl.hh>
 #include <glow/objects/Framebuffer.hh>
 #include <glow/objects/Program.hh>
+#include <glow/objects/Shader.hh>
 #include <glow/objects/VertexArray.hh>
 #include <glow/objects/ElementArrayBuffer.hh>
 #include <glow/objects/ArrayBuffer.hh>
 #include <glow/objects/UniformBuffer.hh>
 #include <glow/objects/ShaderStorageBuffer.hh>
+#include <glow/common/log.hh>
 
 #include <engine/graphics/DrawCall.hpp>
+#include <engine/graphics/CpuDenoiser.hpp>
+#include <engine/utils/stb_image_write.h>
 #include <engine/events/DrawEvent.hpp>
 #include <engine/events/ResizeWindowEvent.hpp>
 #include <glm/ext.hpp>
@@ -19,6 +24,10 @@
 
 #include <glow/std140.hh>
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
 #undef near
 #undef far
 
@@ -49,7 +58,8 @@ struct Primitive {
 	Vertex c;
     uint32_t matId;
     uint32_t sortCode;
-    glm::vec2 pad__;
+    uint32_t sortCodeHi;
+    uint32_t drawId;
 };
 
 struct CameraData {
@@ -68,20 +78,48 @@ struct GPULight {
     glm::vec4 color;
 };
 
-const glm::uint MAX_TEXTURES = 8;
-
-struct GPUMaterial {
-    glm::vec3 diffuseColor;
-    float roughness;
-    glm::vec3 emissiveColor;
-    float refractiveness;
-    glm::vec3 specularColor;
-    float eta;
-    glm::uint diffuseTexId;
-    glm::uint specularTexId;
-    glm::uint emissiveTexId;
-    glm::uint normalTexId;
-};
+// Keep in sync with RadianceCache.glsl
+const size_t RADIANCE_CACHE_SIZE = 1 << 18;
+const size_t RADIANCE_CACHE_ENTRY_SIZE = 8 * sizeof(uint32_t);
+const size_t RESERVOIR_SIZE = 20 * sizeof(float);
+const int RESTIR_MOTION_TEXTURE_UNIT = 8; // after the material texture arrays
+const int VISIBILITY_TEXTURE_UNIT = 9;
+const int SAMPLE_WEIGHT_TEXTURE_UNIT = 10;
+
+static bool hasExtension(const char* name) {
+  GLint extensionCount = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+  for (GLint i = 0; i < extensionCount; i++) {
+    auto ext = (const char*)glGetStringi(GL_EXTENSIONS, i);
+    if (ext && strcmp(ext, name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+#ifndef GL_WARP_SIZE_NV
+#define GL_WARP_SIZE_NV 0x9339
+#define GL_WARPS_PER_SM_NV 0x933A
+#define GL_SM_COUNT_NV 0x933B
+#endif
+
+// Number of 8x8 groups that keeps every multiprocessor busy without
+// oversubscribing it. GL has no portable way to query the core count, so
+// we fall back to a guess for a mid-range GPU if the NV extension is missing.
+static int queryPersistentGroupCount() {
+  const int threadsPerGroup = 64;
+  if (hasExtension("GL_NV_shader_thread_group")) {
+    GLint warpSize = 0, warpsPerSm = 0, smCount = 0;
+    glGetIntegerv(GL_WARP_SIZE_NV, &warpSize);
+    glGetIntegerv(GL_WARPS_PER_SM_NV, &warpsPerSm);
+    glGetIntegerv(GL_SM_COUNT_NV, &smCount);
+    if (warpSize > 0 && warpsPerSm > 0 && smCount > 0) {
+      return std::max(1, smCount * warpsPerSm * warpSize / threadsPerGroup);
+    }
+  }
+  return 16 * 2048 / threadsPerGroup;
+}
 
 bool RendererSystem::startup() {
   RESOLVE_DEPENDENCY(m_settings);
@@ -97,15 +135,17 @@ bool RendererSystem::startup() {
     fx->startup();
   }
 
-  m_camDataBuffer = ShaderStorageBuffer::create();
-  m_primitiveBuffer = ShaderStorageBuffer::create();
-  {
-      auto boundSSBO = m_primitiveBuffer->bind();
-      boundSSBO.reserve(sizeof(Primitive) * MAX_PRIMITIVE_COUNT, GL_DYNAMIC_DRAW);
+  m_uploadRing.create(UPLOAD_RING_REGION_SIZE);
+  if (!m_uploadRing.reserveBindings(RAYCAST_STORAGE_BINDINGS, UPLOAD_RING_BINDING_COUNT, m_uploadRingBinding)) {
+    glow::error() << "The tracer needs more storage buffer bindings than this driver has\n";
   }
+  m_primitiveBuffer.create(sizeof(Primitive), INITIAL_PRIMITIVE_CAPACITY);
+  m_workQueueBuffer = ShaderStorageBuffer::create();
+  m_workQueueBuffer->bind().reserve(sizeof(uint32_t), GL_DYNAMIC_DRAW);
+
+  m_persistentGroupCount = queryPersistentGroupCount();
 
-  m_lightDataBuffer = ShaderStorageBuffer::create();
-  m_materialDataBuffer = ShaderStorageBuffer::create();
+  m_gpuProfiler.create();
 
   // Set up framebuffer for deferred shading
   auto windowSize = m_window->getSize();
@@ -115,79 +155,530 @@ bool RendererSystem::startup() {
 
   m_normalMotionBuffer = createScreenspaceTexture(currentGBufferSize, GL_RGBA16F);
   m_depthBuffer = createScreenspaceTexture(currentGBufferSize, GL_DEPTH_COMPONENT24);
+  m_visibilityBuffer = createScreenspaceTexture(currentGBufferSize, GL_R32UI);
+  {
+      // Integer textures are incomplete with linear filtering
+      auto boundTex = m_visibilityBuffer->bind();
+      boundTex.setMinFilter(GL_NEAREST);
+      boundTex.setMagFilter(GL_NEAREST);
+  }
 
   m_gBufferObject =
-      Framebuffer::create({{"oNormalMotion", m_normalMotionBuffer}}, m_depthBuffer);
+      Framebuffer::create({{"oNormalMotion", m_normalMotionBuffer}, {"oVisibility", m_visibilityBuffer}}, m_depthBuffer);
 
   m_primaryCompositingBuffer = Framebuffer::create({ { "oColor", createScreenspaceTexture(currentGBufferSize, GL_RGBA32F) } });
 
-  m_secondaryCompositingBuffer = Framebuffer::create({ { "oColor", createScreenspaceTexture(currentGBufferSize, GL_RGBA32F) } });
-
-  m_postfxTargetBuffer = Framebuffer::create({ { "oColor", createScreenspaceTexture(currentGBufferSize, GL_RGBA32F) } });
+  m_renderGraph.create(this, &m_gpuProfiler);
 
   m_blitProgram = Program::createFromFile("Blit");
   m_passBlitProgram = Program::createFromFile("PassBlit");
   m_txaaProg = Program::createFromFile("TXAA");
   {
       auto usedProgram = m_txaaProg->use();
-      usedProgram.setUniform("uAlpha", 0.9f);
+      usedProgram.setUniform("uMaxHistoryLength", 32.0f);
+      usedProgram.setUniform("uClipGamma", 1.25f);
   }
 
-  m_raycastComputeProgram = Program::createFromFile("compute/RaycastCompute.csh");
-  m_raycastComputeProgram->saveBinaryToFile("raycastCompute.shbin");
-  {
-      auto usedProgram = m_raycastComputeProgram->use();
-      usedProgram.setUniform("uMaxBounces", 4);
-      usedProgram.setUniform("uSampleCount", 1);
+  // The tier follows the quality setting until it is changed in the UI
+  m_traceTier = (int)m_quality;
+  setRaycastUniform("uPersistentThreads", m_persistentThreads);
+  setRaycastUniform("uWorkItemMode", 1);
+  setRaycastUniform("uRadianceCacheEnabled", m_radianceCacheEnabled);
+  setRaycastUniform("uHybridPrimary", m_hybridPrimary);
+  setRaycastUniform("uInterleave", m_interleave);
+  setRaycastUniform("uRestirEnabled", m_restirEnabled);
+  setRaycastUniform("uIrradianceVolumeSecondary", false);
+  setRaycastUniform("uAdaptiveSampling", m_adaptiveSampling);
+  setRaycastUniform("uSampleBudget", 2.0f);
+  setRaycastUniform("uMaxAdaptiveSamples", 8);
+  setRaycastUniform("uRestirCandidates", 32);
+  setRaycastUniform("uRestirSpatialSamples", 3);
+  setRaycastUniform("uRestirSpatialRadius", 16.0f);
+  setRaycastUniform("uRadianceCacheCellSize", 0.25f);
+  setRaycastUniform("uRadianceCacheUpdateRatio", 0.1f);
+  setRaycastUniform("uRadianceCacheMinSamples", 16u);
+  setRaycastUniform("uAmbientOcclusionSamples", 2);
+  setRaycastUniform("uAmbientOcclusionRadius", 1.0f);
+  setRaycastUniform("uAmbientColor", glm::vec3(0.1f));
+
+  m_textureTable.create(hasExtension("GL_ARB_bindless_texture"));
+  setRaycastStorageBuffer("TextureTableBuffer", m_textureTable.entryBuffer());
+  m_materials.create();
+  setRaycastStorageBuffer("MaterialBuffer", m_materials.buffer());
+  if (!m_textureTable.isBindless()) {
+      for (int i = 0; i < TextureTable::MAX_TEXTURE_ARRAYS; i++) {
+          setRaycastUniform("materialTextureArrays[" + std::to_string(i) + "]", i);
+      }
   }
-  m_motionVectorProgram = Program::createFromFile("MotionVectors");
-  m_sortPrimitiveProgram = Program::createFromFile("compute/SortPrimitive.csh");
-  m_sortPrimitiveProgram->setShaderStorageBuffer("PrimitiveBuffer", m_primitiveBuffer);
-  m_mergePrimitiveProgram = Program::createFromFile("compute/MergePrimitive.csh");
-  m_mergePrimitiveProgram->setShaderStorageBuffer("PrimitiveBuffer", m_primitiveBuffer);
 
-  m_raycastComputeProgram->setShaderStorageBuffer("PrimitiveBuffer", m_primitiveBuffer);
-  m_raycastComputeProgram->setShaderStorageBuffer("CameraBuffer", m_camDataBuffer);
-  m_raycastComputeProgram->setShaderStorageBuffer("LightBuffer", m_lightDataBuffer);
-  m_raycastComputeProgram->setShaderStorageBuffer("MaterialBuffer", m_materialDataBuffer);
+  // Warm the cache with every tier, so switching doesn't stall
+  for (int tier = 0; tier < 3; tier++) {
+      auto program = getRaycastProgram({ tier, m_maxBounces, m_sampleCount, true, false, m_textureTable.isBindless() });
+      program->use();
+
+      GLint linked = GL_FALSE;
+      glGetProgramiv(program->getObjectName(), GL_LINK_STATUS, &linked);
+      if (linked) {
+          glow::info() << "Compiled tracing kernel for tier " << tier << "\n";
+      } else {
+          glow::error() << "Tracing kernel for tier " << tier << " failed to compile\n";
+      }
+  }
+  m_raycastComputeProgram = getRaycastProgram({ m_traceTier, m_maxBounces, m_sampleCount, true, false,
+                                                m_textureTable.isBindless() });
+  m_raycastComputeProgram->saveBinaryToFile("raycastCompute.shbin");
+  m_motionVectorProgram = Program::createFromFile("MotionVectors");
+  m_pullVertexArray = VertexArray::create(GL_TRIANGLES);
+
+  m_gpuPrimitives.startup();
+  m_primitiveSortKeysProgram = Program::createFromFile("compute/PrimitiveSortKeys.csh");
+  m_gatherPrimitiveProgram = Program::createFromFile("compute/GatherPrimitive.csh");
+  m_mortonCodeProgram = Program::createFromFile("compute/MortonCode.csh");
+
+  m_primitiveSortKeys.create(sizeof(uint32_t), INITIAL_PRIMITIVE_CAPACITY);
+  m_primitiveSortValues.create(sizeof(uint32_t), INITIAL_PRIMITIVE_CAPACITY);
+  m_sortedPrimitiveBuffer.create(sizeof(Primitive), INITIAL_PRIMITIVE_CAPACITY);
+  m_centroidBuffer.create(sizeof(glm::vec4), INITIAL_PRIMITIVE_CAPACITY);
+  m_sceneBoundsBuffer = ShaderStorageBuffer::create();
+  m_sceneBoundsBuffer->bind().reserve(sizeof(glm::vec4) * 2, GL_DYNAMIC_DRAW);
+  m_primitiveRemapBuffer.create(sizeof(uint32_t), INITIAL_PRIMITIVE_CAPACITY);
+
+  setRaycastStorageBuffer("PrimitiveBuffer", m_primitiveBuffer.buffer());
+  setRaycastStorageBuffer("WorkQueueBuffer", m_workQueueBuffer);
+  setRaycastStorageBuffer("PrimitiveRemapBuffer", m_primitiveRemapBuffer.buffer());
+
+  m_radianceCacheBuffer = ShaderStorageBuffer::create();
+  m_radianceCacheBuffer->bind().reserve(RADIANCE_CACHE_SIZE * RADIANCE_CACHE_ENTRY_SIZE, GL_DYNAMIC_DRAW);
+  clearRadianceCache();
+  m_radianceCacheUpdateProgram = Program::createFromFile("compute/RadianceCacheUpdate.csh");
+  m_radianceCacheUpdateProgram->setShaderStorageBuffer("RadianceCacheBuffer", m_radianceCacheBuffer);
+  setRaycastStorageBuffer("RadianceCacheBuffer", m_radianceCacheBuffer);
 
   m_copyPrimitiveProgram = Program::createFromFile("compute/CopyPrimitive.csh");
 
+  m_irradianceVolumeBuffer = ShaderStorageBuffer::create();
+  setRaycastStorageBuffer("IrradianceVolumeBuffer", m_irradianceVolumeBuffer);
+  if (m_irradianceVolume.load(getIrradianceVolumePath())) {
+      m_irradianceVolumeEnabled = m_quality == QualitySetting::Low;
+  }
+  uploadIrradianceVolume();
+  m_reconstructProgram = Program::createFromFile("compute/Reconstruct.csh");
+
+  m_sampleAllocationBuffer = ShaderStorageBuffer::create();
+  m_sampleAllocationBuffer->bind().reserve(2 * sizeof(uint32_t), GL_DYNAMIC_DRAW);
+  m_sampleAllocationProgram = Program::createFromFile("compute/SampleAllocation.csh");
+  m_sampleAllocationProgram->setShaderStorageBuffer("SampleAllocationBuffer", m_sampleAllocationBuffer);
+  setRaycastStorageBuffer("SampleAllocationBuffer", m_sampleAllocationBuffer);
+
+  m_svgf = std::make_shared<SVGFPostFX>(this, m_events, m_quality);
+  m_svgf->startup();
+
   m_events->subscribe<ResizeWindowEvent>([this](const ResizeWindowEvent &e) {
     glViewport(0, 0, (int)e.newSize.x, (int)e.newSize.y);
     for (auto tex : m_screenSpaceTextures) {
-      glm::vec2 newSize = e.newSize * 1.0f / (1 >> (int)tex.size);
+      glm::vec2 newSize = e.newSize * 1.0f / (1 << (int)tex.size);
       tex.texture->bind().resize((int)newSize.x, (int)newSize.y);
     }
   });
 
   m_events->subscribe<"DrawUI"_sh>([this]() {
       ImGui::Begin("Render Settings");
-      static int maxBounces = 4;
-      static int sampleCount = 1;
-      static float txaaAlpha = 0.9f;
-      if (ImGui::InputInt("Max Bounces", &maxBounces)) {
-          auto usedProgram = m_raycastComputeProgram->use();
-          usedProgram.setUniform("uMaxBounces", maxBounces);
+      static int txaaMaxHistory = 32;
+      static float txaaClipGamma = 1.25f;
+      ImGui::Combo("Tracing Tier", &m_traceTier, "Direct + AO\0Two Bounces\0Path Tracing\0");
+
+      static int aoSamples = 2;
+      static float aoRadius = 1.0f;
+      if (m_traceTier == 0) {
+          if (ImGui::SliderInt("AO Samples", &aoSamples, 1, 16)) {
+              setRaycastUniform("uAmbientOcclusionSamples", aoSamples);
+          }
+
+          if (ImGui::SliderFloat("AO Radius", &aoRadius, 0.05f, 8.0f)) {
+              setRaycastUniform("uAmbientOcclusionRadius", aoRadius);
+          }
+      }
+
+      // Both are compiled into the kernel, every new value is a new permutation
+      if (ImGui::InputInt("Max Bounces", &m_maxBounces)) {
+          m_maxBounces = glm::clamp(m_maxBounces, 1, 16);
+      }
+
+      if (ImGui::InputInt("Sample Count", &m_sampleCount)) {
+          m_sampleCount = glm::clamp(m_sampleCount, 1, 64);
+      }
+      ImGui::Text("%d kernel permutations compiled", (int)m_raycastPermutations.size());
+      if (m_textureTable.isBindless()) {
+          ImGui::Text("%d material textures, bindless", (int)m_textureTable.size());
+      } else {
+          ImGui::Text("%d material textures in %d arrays", (int)m_textureTable.size(),
+                      (int)m_textureTable.arrayCount());
       }
 
-      if (ImGui::InputInt("Sample Count", &sampleCount)) {
-          auto usedProgram = m_raycastComputeProgram->use();
-          usedProgram.setUniform("uSampleCount", sampleCount);
+      if (ImGui::SliderInt("TXAA Max History", &txaaMaxHistory, 1, 256)) {
+          auto usedProgram = m_txaaProg->use();
+          usedProgram.setUniform("uMaxHistoryLength", (float)txaaMaxHistory);
       }
 
-      if (ImGui::SliderFloat("TXAA Alpha", &txaaAlpha, 0, 1)) {
+      // Smaller values reject more history and ghost less, but keep more noise
+      if (ImGui::SliderFloat("TXAA Clip Gamma", &txaaClipGamma, 0.5f, 4.0f)) {
           auto usedProgram = m_txaaProg->use();
-          usedProgram.setUniform("uAlpha", txaaAlpha);
+          usedProgram.setUniform("uClipGamma", txaaClipGamma);
+      }
+
+      if (ImGui::Checkbox("Rasterized Primary Hits", &m_hybridPrimary)) {
+          setRaycastUniform("uHybridPrimary", m_hybridPrimary);
+      }
+
+      static float sampleBudget = 2.0f;
+      static int maxAdaptiveSamples = 8;
+      if (ImGui::Checkbox("Disocclusion-Aware Sampling", &m_adaptiveSampling)) {
+          setRaycastUniform("uAdaptiveSampling", m_adaptiveSampling);
       }
+
+      // Average samples per pixel, every pixel keeps at least one
+      if (ImGui::SliderFloat("Sample Budget", &sampleBudget, 1.0f, 8.0f)) {
+          setRaycastUniform("uSampleBudget", sampleBudget);
+      }
+
+      if (ImGui::InputInt("Max Samples per Pixel", &maxAdaptiveSamples)) {
+          maxAdaptiveSamples = std::max(1, maxAdaptiveSamples);
+          setRaycastUniform("uMaxAdaptiveSamples", maxAdaptiveSamples);
+      }
+
+      static int interleaveMode = 0;
+      if (ImGui::Combo("Interleaved Tracing", &interleaveMode, "Off\0Checkerboard\0One per Quad\0")) {
+          m_interleave = 1 << interleaveMode;
+          setRaycastUniform("uInterleave", m_interleave);
+      }
+
+      ImGui::Separator();
+      ImGui::Checkbox("Dynamic Resolution", &m_dynamicResolution);
+      ImGui::SliderFloat("Target Frame Time (ms)", &m_targetFrameTimeMs, 4.0f, 50.0f);
+      if (ImGui::SliderFloat("Min Resolution Scale", &m_minResolutionScale, 0.25f, 1.0f)) {
+          m_maxResolutionScale = std::max(m_maxResolutionScale, m_minResolutionScale);
+      }
+      if (ImGui::SliderFloat("Max Resolution Scale", &m_maxResolutionScale, 0.25f, 1.0f)) {
+          m_minResolutionScale = std::min(m_minResolutionScale, m_maxResolutionScale);
+      }
+      auto renderSize = getRenderSize();
+      ImGui::Text("GPU %.2f ms, rendering %dx%d (%.0f%%)", m_gpuFrameTimeMs, renderSize.x, renderSize.y,
+                  m_resolutionScale * 100.0f);
+
+      ImGui::Separator();
+      static int workItemMode = 1;
+      if (ImGui::Checkbox("Persistent Threads", &m_persistentThreads)) {
+          setRaycastUniform("uPersistentThreads", m_persistentThreads);
+      }
+
+      if (ImGui::Combo("Work Items", &workItemMode, "Tiles\0Paths\0")) {
+          setRaycastUniform("uWorkItemMode", workItemMode);
+      }
+
+      if (ImGui::InputInt("Persistent Groups", &m_persistentGroupCount)) {
+          m_persistentGroupCount = std::max(1, m_persistentGroupCount);
+      }
+
+      ImGui::Separator();
+      static float cacheCellSize = 0.25f;
+      static float cacheUpdateRatio = 0.1f;
+      static int cacheMinSamples = 16;
+      if (ImGui::Checkbox("Radiance Cache", &m_radianceCacheEnabled)) {
+          setRaycastUniform("uRadianceCacheEnabled", m_radianceCacheEnabled);
+      }
+
+      // Bigger cells and fewer required samples terminate earlier but blur
+      // indirect light more.
+      if (ImGui::SliderFloat("Cache Cell Size", &cacheCellSize, 0.01f, 2.0f)) {
+          setRaycastUniform("uRadianceCacheCellSize", cacheCellSize);
+          clearRadianceCache();
+      }
+
+      if (ImGui::SliderFloat("Cache Update Ratio", &cacheUpdateRatio, 0.0f, 1.0f)) {
+          setRaycastUniform("uRadianceCacheUpdateRatio", cacheUpdateRatio);
+      }
+
+      if (ImGui::InputInt("Cache Min Samples", &cacheMinSamples)) {
+          cacheMinSamples = std::max(1, cacheMinSamples);
+          setRaycastUniform("uRadianceCacheMinSamples", (uint32_t)cacheMinSamples);
+      }
+
+      ImGui::InputInt("Cache Max Samples", &m_radianceCacheMaxSamples);
+      ImGui::InputInt("Cache Max Age", &m_radianceCacheMaxAge);
+
+      if (ImGui::Button("Clear Radiance Cache")) {
+          clearRadianceCache();
+      }
+
+      ImGui::Separator();
+      static bool volumeSecondary = false;
+      if (ImGui::Checkbox("Irradiance Volume", &m_irradianceVolumeEnabled)) {
+          uploadIrradianceVolume();
+      }
+
+      if (ImGui::Checkbox("Volume for Secondary Bounces", &volumeSecondary)) {
+          setRaycastUniform("uIrradianceVolumeSecondary", volumeSecondary);
+      }
+
+      ImGui::SliderFloat("Probe Spacing", &m_irradianceBakeSettings.probeSpacing, 0.1f, 8.0f);
+      ImGui::InputInt("Rays per Probe", &m_irradianceBakeSettings.raysPerProbe);
+      ImGui::InputInt("Bake Bounces", &m_irradianceBakeSettings.bounces);
+      if (ImGui::Button("Bake Irradiance Volume")) {
+          m_bakeIrradianceVolume = true;
+      }
+      auto volumeRes = m_irradianceVolume.resolution;
+      ImGui::Text("%d x %d x %d probes", volumeRes.x, volumeRes.y, volumeRes.z);
+
+      ImGui::Separator();
+      static int restirCandidates = 32;
+      static int restirSpatialSamples = 3;
+      static float restirSpatialRadius = 16.0f;
+      if (ImGui::Checkbox("ReSTIR Direct Lighting", &m_restirEnabled)) {
+          setRaycastUniform("uRestirEnabled", m_restirEnabled);
+      }
+
+      if (ImGui::InputInt("ReSTIR Candidates", &restirCandidates)) {
+          restirCandidates = std::max(1, restirCandidates);
+          setRaycastUniform("uRestirCandidates", restirCandidates);
+      }
+
+      if (ImGui::InputInt("ReSTIR Spatial Samples", &restirSpatialSamples)) {
+          restirSpatialSamples = std::max(0, restirSpatialSamples);
+          setRaycastUniform("uRestirSpatialSamples", restirSpatialSamples);
+      }
+
+      if (ImGui::SliderFloat("ReSTIR Spatial Radius", &restirSpatialRadius, 1.0f, 64.0f)) {
+          setRaycastUniform("uRestirSpatialRadius", restirSpatialRadius);
+      }
+
+      ImGui::Separator();
+      ImGui::Checkbox("SVGF Denoiser", &m_svgf->enabled);
+      m_svgf->drawUI();
+
+      if (ImGui::Button("Export Denoised Frame")) {
+          exportDenoisedFrame("frame");
+      }
+
+      ImGui::Separator();
+      ImGui::Checkbox("Morton Sort Primitives", &m_sortPrimitives);
+      if (ImGui::Checkbox("64-bit Morton Codes", &m_use64BitMorton)) {
+          m_primitivesValid = false;
+      }
+      ImGui::Text("%d primitives copied this frame", (int)m_copiedPrimitiveCount);
+      ImGui::Checkbox("Frustum Culling", &m_frustumCulling);
+      ImGui::Checkbox("SIMD Culling", &m_simdCulling);
+      ImGui::Text("%d / %d draw calls rasterized%s", (int)m_rasterizedDrawCalls, (int)m_residentDrawCalls.size(),
+                  m_simdCulling && FrustumCulling::hasAVX() ? " (AVX)" : "");
+      ImGui::Text("Primitive buffer: %d / %d (%.1f MB, %d reallocations)",
+                  (int)m_primitiveBuffer.count(), (int)m_primitiveBuffer.capacity(),
+                  m_primitiveBuffer.bytesAllocated() / (1024.0f * 1024.0f),
+                  (int)m_primitiveBuffer.reallocations());
+      ImGui::Text("Upload ring: %d / %d KB peak, %d fence waits%s",
+                  (int)(m_uploadRing.peakUsage() / 1024), (int)(m_uploadRing.regionSize() / 1024),
+                  (int)m_uploadRing.fenceWaits(), m_uploadRing.isPersistent() ? "" : " (not mapped)");
+      ImGui::Text("Render graph: %d transients in %d textures (%.1f of %.1f MB), %d barriers",
+                  (int)m_renderGraph.transientCount(), (int)m_renderGraph.poolSize(),
+                  m_renderGraph.poolBytes() / (1024.0f * 1024.0f),
+                  m_renderGraph.transientBytes() / (1024.0f * 1024.0f), (int)m_renderGraph.barrierCount());
+      m_gpuPrimitives.drawUI();
       ImGui::End();
+
+      m_gpuProfiler.drawUI();
   }, -1);
 
   return true;
 }
 
 
-void RendererSystem::showTextureChooser(glow::SharedTexture2D& tex, std::string id) {
+std::string RaycastPermutation::defines() const {
+  // Extensions have to come before any code, the defines go right after #version
+  std::string extensions = bindlessTextures ? "#extension GL_ARB_bindless_texture : require\n" : "";
+  return extensions +
+         "#define TRACE_TIER " + std::to_string(traceTier) + "\n"
+         "#define MAX_BOUNCES " + std::to_string(maxBounces) + "\n"
+         "#define SAMPLE_COUNT " + std::to_string(sampleCount) + "\n"
+         "#define MATERIAL_TEXTURES " + std::to_string((int)materialTextures) + "\n"
+         "#define DEPTH_OF_FIELD " + std::to_string((int)depthOfField) + "\n"
+         "#define BINDLESS_TEXTURES " + std::to_string((int)bindlessTextures) + "\n";
+}
+
+SharedProgram RendererSystem::getRaycastProgram(const RaycastPermutation& permutation) {
+  auto defines = permutation.defines();
+  auto it = m_raycastPermutations.find(defines);
+  if (it != m_raycastPermutations.end()) {
+    return it->second;
+  }
+
+  // The includes are expanded here, a source string has no directory they
+  // could be resolved against
+  std::string source = "#version 430\n" + defines +
+                       expandShaderIncludes(m_settings->getFullShaderPath() + "compute/RaycastCompute.glsl");
+  auto program = Program::create(Shader::createFromSource(GL_COMPUTE_SHADER, source));
+  for (auto& state : m_raycastState) {
+    state.second(program);
+  }
+
+  m_raycastPermutations[defines] = program;
+  return program;
+}
+
+void RendererSystem::setRaycastStorageBuffer(const std::string& name, SharedShaderStorageBuffer buffer) {
+  auto apply = [name, buffer](const SharedProgram& program) {
+    program->setShaderStorageBuffer(name, buffer);
+  };
+
+  for (auto& permutation : m_raycastPermutations) {
+    apply(permutation.second);
+  }
+  m_raycastState["buffer " + name] = apply;
+}
+
+void RendererSystem::clearRadianceCache() {
+  auto boundBuffer = m_radianceCacheBuffer->bind();
+  glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+}
+
+// Scales the render size by the square root of the budget ratio so the pixel
+// count follows the frame time. The step is damped and clamped to avoid
+// oscillating between two sizes.
+void RendererSystem::updateResolutionScale() {
+  if (!m_dynamicResolution) {
+    m_resolutionScale = m_maxResolutionScale;
+    return;
+  }
+
+  if (m_gpuFrameTimeMs <= 0) {
+    return;
+  }
+
+  float ratio = m_targetFrameTimeMs / m_gpuFrameTimeMs;
+  float step = glm::clamp(std::sqrt(ratio), 0.9f, 1.05f);
+  m_resolutionScale = glm::clamp(m_resolutionScale * step, m_minResolutionScale, m_maxResolutionScale);
+}
+
+glm::ivec2 RendererSystem::getRenderSize() {
+  auto fullSize = glm::vec2(m_gBufferObject->getDim());
+  auto size = glm::ivec2(glm::ceil(fullSize * m_resolutionScale));
+  return glm::clamp(size, glm::ivec2(8), glm::ivec2(fullSize));
+}
+
+std::string RendererSystem::getIrradianceVolumePath() {
+  return m_settings->getResourcePath() + "irradiance_volume.bin";
+}
+
+void RendererSystem::uploadIrradianceVolume() {
+  bool enabled = m_irradianceVolumeEnabled && !m_irradianceVolume.empty();
+  if (enabled) {
+    auto boundBuffer = m_irradianceVolumeBuffer->bind();
+    boundBuffer.setData(m_irradianceVolume.probes, GL_STATIC_DRAW);
+  }
+
+  setRaycastUniform("uIrradianceVolumeEnabled", enabled);
+  setRaycastUniform("uIrradianceVolumeResolution", m_irradianceVolume.resolution);
+  setRaycastUniform("uIrradianceVolumeMin", m_irradianceVolume.boundsMin);
+  setRaycastUniform("uIrradianceVolumeMax", m_irradianceVolume.boundsMax);
+}
+
+// Bakes from the world space primitives of the current frame, so everything
+// that is on screen right now counts as static scene
+void RendererSystem::bakeIrradianceVolume(size_t primitiveCount, const std::vector<BakeMaterial>& materials,
+                                          const std::vector<BakeLight>& lights) {
+  std::vector<Primitive> primitives(primitiveCount);
+  glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_primitiveBuffer.buffer()->getObjectName());
+  glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(Primitive) * primitiveCount, primitives.data());
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  std::vector<BakeTriangle> triangles;
+  triangles.reserve(primitiveCount);
+  for (auto& prim : primitives) {
+    if (prim.matId < materials.size()) {
+      triangles.push_back({ prim.a.pos, prim.b.pos, prim.c.pos, prim.matId });
+    }
+  }
+
+  m_irradianceVolume = IrradianceVolume::bake(triangles, materials, lights, m_irradianceBakeSettings);
+  m_irradianceVolume.save(getIrradianceVolumePath());
+  m_irradianceVolumeEnabled = !m_irradianceVolume.empty();
+  uploadIrradianceVolume();
+}
+
+void RendererSystem::ensureReservoirs(RenderPass& pass, size_t count) {
+  if (pass.reservoirs && pass.reservoirCount == count) {
+    return;
+  }
+
+  // Zeroed reservoirs have no valid surface, so nothing is reused from them
+  for (auto buffer : { &pass.reservoirs, &pass.prevReservoirs }) {
+    *buffer = ShaderStorageBuffer::create();
+    auto boundBuffer = (*buffer)->bind();
+    boundBuffer.reserve(count * RESERVOIR_SIZE, GL_DYNAMIC_DRAW);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+  }
+
+  pass.reservoirCount = count;
+}
+
+// Exports the composited frame ahead of post effects
+void RendererSystem::exportDenoisedFrame(const std::string& path) {
+  auto colorTex = m_primaryCompositingBuffer->getColorAttachments()[0].texture;
+  auto size = m_primaryCompositingBuffer->getDim();
+  auto pixelCount = (size_t)size.x * size.y;
+
+  std::vector<float> color(pixelCount * 3);
+  std::vector<float> normalMotion(pixelCount * 4);
+
+  glBindTexture(GL_TEXTURE_2D, colorTex->getObjectName());
+  glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_FLOAT, color.data());
+
+  bool hasNormals = glm::ivec2(m_normalMotionBuffer->getDim()) == glm::ivec2(size) &&
+                    getRenderSize() == glm::ivec2(size);
+  if (hasNormals) {
+    glBindTexture(GL_TEXTURE_2D, m_normalMotionBuffer->getObjectName());
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, normalMotion.data());
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  // GL rows start at the bottom, image files at the top
+  std::vector<float> flippedColor(pixelCount * 3);
+  std::vector<float> normals(pixelCount * 3);
+  for (int y = 0; y < size.y; y++) {
+    for (int x = 0; x < size.x; x++) {
+      size_t src = (size_t)y * size.x + x;
+      size_t dst = (size_t)(size.y - 1 - y) * size.x + x;
+
+      for (int c = 0; c < 3; c++) {
+        flippedColor[dst * 3 + c] = color[src * 3 + c];
+      }
+
+      // Same encoding as MotionVectors.fsh
+      float phi = normalMotion[src * 4 + 0] * glm::pi<float>();
+      float z = normalMotion[src * 4 + 1];
+      float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+      normals[dst * 3 + 0] = r * std::cos(phi);
+      normals[dst * 3 + 1] = r * std::sin(phi);
+      normals[dst * 3 + 2] = z;
+    }
+  }
+
+  DenoiseInput input;
+  input.width = size.x;
+  input.height = size.y;
+  input.color = flippedColor.data();
+  input.albedo = nullptr;
+  input.normal = hasNormals ? normals.data() : nullptr;
+  input.depth = nullptr;
+
+  std::vector<float> denoised(pixelCount * 3);
+  CpuDenoiser::denoise(input, denoised.data());
+
+  stbi_write_hdr((path + ".hdr").c_str(), size.x, size.y, 3, flippedColor.data());
+  stbi_write_hdr((path + "_denoised.hdr").c_str(), size.x, size.y, 3, denoised.data());
+  glow::info() << "Exported " << path << ".hdr and " << path << "_denoised.hdr";
+}
+
+bool RendererSystem::showTextureChooser(glow::SharedTexture2D& tex, std::string id) {
+    auto previous = tex;
     const std::string butStr = std::string("Button") + id;
     const char* butId = butStr.c_str();
     ImGui::PushID(butId);
@@ -228,20 +719,276 @@ void RendererSystem::showTextureChooser(glow::SharedTexture2D& tex, std::string
     }
     ImGui::PopID();
 
+    return tex != previous;
 }
 
-static unsigned int log2i(unsigned int val) {
-    if (val == 0) return UINT_MAX;
-    if (val == 1) return 0;
-    unsigned int ret = 0;
-    while (val > 1) {
-        val >>= 1;
-        ret++;
-    }
-    return ret;
-}
+// Scene work that doesn't depend on the camera: primitive assembly and
+// sorting, the material table, lights and draw transforms. Runs once per
+// frame, every render pass traces the same primitives and masks out the
+// draw calls and lights it doesn't see.
+void RendererSystem::prepareScene(double interp) {
+  size_t totalPrimitiveCount = 0;
+
+  // Only materials changed since last frame are written
+  m_materials.update(m_textureTable);
+
+  // Takes this frame's world positions of a draw call to last frame's,
+  // indexed by draw call
+  std::vector<glm::mat4> drawTransforms;
+
+  // The passes seeing each draw call, indexed like the draw transforms
+  std::vector<uint32_t> drawPassMasks;
+  m_passesWithAllDrawCalls = ~0u;
+
+  // This frame's layout of m_primitiveBuffer, in submission order
+  std::vector<ResidentDrawCall> drawCallLayout;
+
+  for (size_t i = 0; i < m_submittedDrawCalls.size(); i++) {
+      auto drawCall = m_submittedDrawCalls[i];
+
+      if (drawCall.lastRenderTransform == drawCall.thisRenderTransform) {
+          drawTransforms.push_back(glm::mat4(1));
+      } else {
+          drawTransforms.push_back(drawCall.lastRenderTransform * glm::inverse(drawCall.thisRenderTransform));
+      }
+      drawPassMasks.push_back(drawCall.renderPassMask);
+      m_passesWithAllDrawCalls &= drawCall.renderPassMask;
+
+      // No geometry loaded for the draw call
+      if (!drawCall.geometry.vao) {
+          continue;
+      }
+
+      SharedArrayBuffer posBuffer;
+      bool hasPos = drawCall.geometry.vao->getBufferForAttribute("aPosition", posBuffer);
+      auto idxBuffer = drawCall.geometry.vao->getIdxBuffer();
+
+      //We need at least positions and indices
+      if (!hasPos || !idxBuffer) {
+          continue;
+      }
+
+      size_t drawPrimCount = idxBuffer->getIndexCount() / 3;
+
+      // Draw calls that don't fit into a single storage block are dropped
+      // instead of writing past the end of the buffer
+      if (totalPrimitiveCount + drawPrimCount > m_primitiveBuffer.maxCount()) {
+          if (!m_primitiveOverflowReported) {
+              glow::error() << "Scene exceeds " << m_primitiveBuffer.maxCount()
+                            << " primitives, some draw calls are not traced";
+              m_primitiveOverflowReported = true;
+          }
+          continue;
+      }
+
+      drawCallLayout.push_back({ drawCall.id, drawCall.geometry.vao->getObjectName(),
+                                 drawCall.thisRenderTransform, drawCall.material, (int)i,
+                                 totalPrimitiveCount, drawPrimCount });
+      totalPrimitiveCount += drawPrimCount;
+  }
+
+  // Growing discards the resident primitives, so everything is copied again
+  bool grown = false;
+  for (auto buffer : { &m_primitiveBuffer, &m_sortedPrimitiveBuffer, &m_centroidBuffer,
+                       &m_primitiveRemapBuffer, &m_primitiveSortKeys, &m_primitiveSortValues }) {
+      grown |= buffer->resize(totalPrimitiveCount);
+  }
+
+  // Offsets only stay valid if the same draw calls come in the same order
+  bool relayout = grown || !m_primitivesValid || m_residentSorted != m_sortPrimitives ||
+                  drawCallLayout.size() != m_residentDrawCalls.size();
+  for (size_t i = 0; i < drawCallLayout.size() && !relayout; i++) {
+      relayout = drawCallLayout[i].id != m_residentDrawCalls[i].id ||
+                 drawCallLayout[i].primitiveCount != m_residentDrawCalls[i].primitiveCount;
+  }
+
+  m_copiedPrimitiveCount = 0;
+
+  {
+      GpuProfilerScope copyScope(m_gpuProfiler, "Copy Primitives");
+      auto boundCopyProgram = m_copyPrimitiveProgram->use();
+
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_primitiveBuffer.buffer()->getObjectName());
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, m_centroidBuffer.buffer()->getObjectName());
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, m_primitiveRemapBuffer.buffer()->getObjectName());
+
+      for (size_t i = 0; i < drawCallLayout.size(); i++) {
+          auto& entry = drawCallLayout[i];
+
+          if (!relayout) {
+              auto& resident = m_residentDrawCalls[i];
+              if (resident.vao == entry.vao && resident.transform == entry.transform &&
+                  resident.material == entry.material && resident.drawIndex == entry.drawIndex) {
+                  continue;
+              }
+          }
+
+          auto drawCall = m_submittedDrawCalls[entry.drawIndex];
 
+          SharedArrayBuffer posBuffer, normBuffer, uvBuffer;
+          drawCall.geometry.vao->getBufferForAttribute("aPosition", posBuffer);
+          auto idxBuffer = drawCall.geometry.vao->getIdxBuffer();
+          bool hasNormals = drawCall.geometry.vao->getBufferForAttribute("aNormal", normBuffer);
+          bool hasUvs = drawCall.geometry.vao->getBufferForAttribute("aTexCoord", uvBuffer);
+
+          glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, posBuffer->getObjectName());
+
+          if(hasNormals) {
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, normBuffer->getObjectName());
+          } else {
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+          }
+
+          if(hasUvs) {
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, uvBuffer->getObjectName());
+          } else {
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+          }
+
+          glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, idxBuffer->getObjectName());
+
+          boundCopyProgram.setUniform("hasNormals", hasNormals);
+          boundCopyProgram.setUniform("hasUvs", hasUvs);
+
+          boundCopyProgram.setUniform("materialId", (int)entry.material);
+          boundCopyProgram.setUniform("drawId", entry.drawIndex);
+          boundCopyProgram.setUniform("model2World", entry.transform);
+          boundCopyProgram.setUniform("model2WorldInvTransp", glm::inverseTranspose(entry.transform));
+          boundCopyProgram.setUniform("currentPrimitiveCount", (int)entry.primitiveCount);
+          boundCopyProgram.setUniform("writeOffset", (int)entry.primitiveOffset);
+          boundCopyProgram.compute((GLuint)entry.primitiveCount / 64 + 1);
+
+          m_copiedPrimitiveCount += entry.primitiveCount;
+      }
+  }
+
+  if (relayout && m_residentSorted != m_sortPrimitives) {
+      setRaycastStorageBuffer("PrimitiveBuffer", (m_sortPrimitives ? m_sortedPrimitiveBuffer : m_primitiveBuffer).buffer());
+  }
+  m_residentDrawCalls = std::move(drawCallLayout);
+  m_residentSorted = m_sortPrimitives;
+  m_primitivesValid = true;
+
+  // The sorted copy and the remap from last frame are still valid if nothing moved
+  if (m_sortPrimitives && totalPrimitiveCount > 1 && m_copiedPrimitiveCount > 0) {
+      GpuProfilerScope sortScope(m_gpuProfiler, "Sort Primitives");
+      auto primitiveCount = (uint32_t)totalPrimitiveCount;
+      glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+      // Quantize centroids relative to this frame's actual scene bounds
+      m_gpuPrimitives.reduceMinMax(m_centroidBuffer.buffer(), primitiveCount, m_sceneBoundsBuffer);
+
+      {
+          auto boundMortonProgram = m_mortonCodeProgram->use();
+          boundMortonProgram.setUniform("primitiveCount", primitiveCount);
+          boundMortonProgram.setUniform("uUse64BitCodes", m_use64BitMorton);
+          glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_primitiveBuffer.buffer()->getObjectName());
+          glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_centroidBuffer.buffer()->getObjectName());
+          glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_sceneBoundsBuffer->getObjectName());
+          boundMortonProgram.compute(primitiveCount / 256 + 1);
+      }
+      glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 
+      // 64 bit codes are sorted by the low word first, then stably by the high word
+      for (int word = 0; word < (m_use64BitMorton ? 2 : 1); word++) {
+          {
+              auto boundKeysProgram = m_primitiveSortKeysProgram->use();
+              boundKeysProgram.setUniform("primitiveCount", primitiveCount);
+              boundKeysProgram.setUniform("uHighWord", word == 1);
+              glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_primitiveBuffer.buffer()->getObjectName());
+              glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_primitiveSortKeys.buffer()->getObjectName());
+              glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_primitiveSortValues.buffer()->getObjectName());
+              boundKeysProgram.compute(primitiveCount / 256 + 1);
+          }
+          glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+          m_gpuPrimitives.sortKeyValue(m_primitiveSortKeys.buffer(), m_primitiveSortValues.buffer(), primitiveCount,
+                                       word == 0 ? (m_use64BitMorton ? 32 : 30) : 31);
+      }
+
+      {
+          auto boundGatherProgram = m_gatherPrimitiveProgram->use();
+          boundGatherProgram.setUniform("primitiveCount", primitiveCount);
+          glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_primitiveBuffer.buffer()->getObjectName());
+          glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_primitiveSortValues.buffer()->getObjectName());
+          glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_sortedPrimitiveBuffer.buffer()->getObjectName());
+          glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_primitiveRemapBuffer.buffer()->getObjectName());
+          boundGatherProgram.compute(primitiveCount / 256 + 1);
+      }
+      glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+  }
+
+  m_drawTransformAllocation = m_uploadRing.allocate(drawTransforms);
+  m_drawPassMaskAllocation = m_uploadRing.allocate(drawPassMasks);
+
+  {
+      std::vector<GPULight> lights;
+      m_passesWithAllLights = ~0u;
+      for (size_t i = 0; i < m_submittedLights.size(); i++) {
+          auto light = m_submittedLights[i];
+
+          auto trans = interpolate(light.lastSimulateTransform, light.thisSimulateTransform, interp);
+          auto pos = glm::vec3(trans * glm::vec4{ 0, 0, 0, 1 });
+          lights.push_back({ pos, light.size, light.color });
+          m_passesWithAllLights &= light.renderPassMask;
+      }
+
+      m_lightAllocation = m_uploadRing.allocate(lights);
+
+      // Passes lit by only some of the lights get their own list
+      for (size_t passIndex = 0; passIndex < m_passes.size(); passIndex++) {
+          auto& pass = m_passes[passIndex];
+          uint32_t passBit = 1u << passIndex;
+          if (!pass.active) {
+              continue;
+          }
+
+          if (m_passesWithAllLights & passBit) {
+              pass.lights = m_lightAllocation;
+              pass.lightCount = lights.size();
+              continue;
+          }
+
+          std::vector<GPULight> passLights;
+          for (size_t i = 0; i < lights.size(); i++) {
+              if (m_submittedLights[i].renderPassMask & passBit) {
+                  passLights.push_back(lights[i]);
+              }
+          }
+          pass.lights = m_uploadRing.allocate(passLights);
+          pass.lightCount = passLights.size();
+      }
+
+      if (m_bakeIrradianceVolume) {
+          m_bakeIrradianceVolume = false;
+
+          std::vector<BakeMaterial> bakeMaterials;
+          for (MaterialHandle handle = 0; handle < m_materials.size(); handle++) {
+              auto& mat = m_materials.get(handle);
+              bakeMaterials.push_back({ mat.diffuseColor, mat.emissiveColor });
+          }
+
+          std::vector<BakeLight> bakeLights;
+          for (auto& light : lights) {
+              bakeLights.push_back({ light.pos, light.size, glm::vec3(light.color) * light.color.a });
+          }
+
+          bakeIrradianceVolume(totalPrimitiveCount, bakeMaterials, bakeLights);
+      }
+  }
+
+  // World space bounds in layout order, culled against each pass' camera
+  m_drawCallBounds.clear();
+  for (auto& resident : m_residentDrawCalls) {
+      auto& geometry = m_submittedDrawCalls[resident.drawIndex].geometry;
+      m_drawCallBounds.push(geometry.boundsMin, geometry.boundsMax, resident.transform);
+  }
+
+  m_scenePrimitiveCount = totalPrimitiveCount;
+
+  // Every pass pulls its vertices from the primitive buffer
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
 
 void RendererSystem::render(RenderPass& pass, double interp, double totalTime) {
   auto camEntity = pass.camera;
@@ -259,6 +1006,9 @@ void RendererSystem::render(RenderPass& pass, double interp, double totalTime) {
     return;
   }
 
+  // Draw calls and lights without this bit are left out of the pass
+  uint32_t passBit = 1u << cam->renderPassIndex;
+
   // Prepare camera coords
   auto camTransform = interpolate(trans->lastGlobalTransform, trans->thisGlobalTransform, interp);
   auto windowSize = m_window->getSize();
@@ -277,10 +1027,14 @@ void RendererSystem::render(RenderPass& pass, double interp, double totalTime) {
     glm::vec3{ 1.0 / 16.0, 8.0 / 9.0, 0 },
   };
 
-  auto gBufferRes = m_gBufferObject->getDim();
+  auto renderSize = getRenderSize();
+  if (pass.lastRenderSize == glm::ivec2(0)) {
+    pass.lastRenderSize = renderSize;
+  }
+
   auto currentOffset = OFFSETS[m_frameIndex % 8] * 2 - 1.0f;
-  currentOffset.x /= gBufferRes.x;
-  currentOffset.y /= gBufferRes.y;
+  currentOffset.x /= renderSize.x;
+  currentOffset.y /= renderSize.y;
   currentOffset.z = 0;
 
   currentOffset *= 0;
@@ -298,233 +1052,317 @@ void RendererSystem::render(RenderPass& pass, double interp, double totalTime) {
   auto camPos = glm::vec3(camTransform * glm::vec4{ 0, 0, 0, 1 });
 
   CameraData camData { camPos, glm::radians(cam->fov), glm::inverse(aaProj), viewMatrix, viewMatrixInverse, cam->lensRadius, cam->focalDistance };
-  {
-      auto camDataBinding = m_camDataBuffer->bind();
-      camDataBinding.setData(camData, GL_DYNAMIC_DRAW);
-  }
+  auto camDataAllocation = m_uploadRing.allocate(camData);
 
-  // Render motion vectors
+  // Render motion vectors and the visibility buffer
   {
+      GpuProfilerScope rasterScope(m_gpuProfiler, "Raster");
       // Set up gbuffer
       auto gBufferBind = m_gBufferObject->bind();
       glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      const GLuint noPrimitive[4] = { 0, 0, 0, 0 };
+      glClearBufferuiv(GL_COLOR, 1, noPrimitive);
 
       glDisable(GL_CULL_FACE);
       glEnable(GL_DEPTH_TEST);
       glDepthMask(GL_TRUE);
       glDisable(GL_BLEND);
-      glViewport(0, 0, gBufferRes.x, gBufferRes.y);
-      glEnable(GL_CULL_FACE);
-
-      auto boundProgram = m_motionVectorProgram->use();
-
-      for (size_t i = 0; i < pass.submittedDrawCallsOpaque.size(); i++) {
-          auto drawCall = pass.submittedDrawCallsOpaque[i];
+      glViewport(0, 0, renderSize.x, renderSize.y);
 
-          boundProgram.setUniform("uFar", cam->far);
-          boundProgram.setUniform("uTime", (float)totalTime);
-          boundProgram.setUniform("uModelMatrix", drawCall.thisRenderTransform);
-          boundProgram.setUniform("uInverseModelMatrix", glm::inverse(drawCall.thisRenderTransform));
-          boundProgram.setUniform("uViewProjectionMatrix", viewProjectionMatrix);
-          boundProgram.setUniform("uPrevModelMatrix", drawCall.lastRenderTransform);
-          boundProgram.setUniform("uPrevViewProjectionMatrix", prevViewProjectionMatrix);
-          drawCall.geometry.vao->bind().draw();
+      // The tracer sees both sides of a triangle, so the visibility buffer has to too
+      if (!m_hybridPrimary) {
+          glEnable(GL_CULL_FACE);
       }
-  }
 
-  size_t totalPrimitiveCount = 0;
+      // The vertices are pulled from the resident primitive buffer, so all
+      // opaque geometry is one multi-draw without per draw call state
+      auto boundProgram = m_motionVectorProgram->use();
+      boundProgram.setUniform("uViewProjectionMatrix", viewProjectionMatrix);
+      boundProgram.setUniform("uPrevViewProjectionMatrix", prevViewProjectionMatrix);
 
-  std::map<GLuint, int> knownTexturesMap;
-  std::vector<GLuint> knowTextures;
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_primitiveBuffer.buffer()->getObjectName());
+      m_drawTransformAllocation.bind(m_motionVectorProgram->getObjectName(), "DrawTransformBuffer", 1);
 
-  auto getTextureIndex = [&](SharedTexture2D tex) -> glm::uint {
-      if (!tex) {
-          return MAX_TEXTURES;
+      if (m_frustumCulling) {
+          FrustumCulling::cull(viewProjectionMatrix, m_drawCallBounds, m_drawCallVisible, m_simdCulling);
+      } else {
+          m_drawCallVisible.assign(m_residentDrawCalls.size(), 1);
       }
 
-      auto it = knownTexturesMap.find(tex->getObjectName());
-      if (it == knownTexturesMap.end()) {
-          knownTexturesMap[tex->getObjectName()] = knowTextures.size();
-          knowTextures.push_back(tex->getObjectName());
-          return knowTextures.size() - 1;
-      } 
-      return it->second;
-  };
-
-  std::vector<GPUMaterial> materials;
-
-  {
-      auto boundCopyProgram = m_copyPrimitiveProgram->use();
-
-      for (size_t i = 0; i < pass.submittedDrawCallsOpaque.size(); i++) {
-          auto drawCall = pass.submittedDrawCallsOpaque[i];
-          auto mat = drawCall.material;
-
-          materials.push_back({
-              mat.diffuseColor, mat.roughness, mat.emissiveColor,
-              mat.refractiveness, mat.specularColor, mat.eta,
-              getTextureIndex(mat.diffuseTexture), getTextureIndex(mat.specularTexture),
-              getTextureIndex(mat.emissiveTexture),getTextureIndex(mat.normalsTexture) });
-
-          // No geometry loaded for the draw call
-          if (!drawCall.geometry.vao) {
+      // Draw calls in view become ranges of the primitive buffer, neighbours
+      // are merged into one range
+      m_rasterFirsts.clear();
+      m_rasterCounts.clear();
+      m_rasterizedDrawCalls = 0;
+      for (size_t i = 0; i < m_residentDrawCalls.size(); i++) {
+          auto& resident = m_residentDrawCalls[i];
+          if (!m_drawCallVisible[i] || !(m_submittedDrawCalls[resident.drawIndex].renderPassMask & passBit)) {
               continue;
           }
 
-          auto mapping = drawCall.geometry.vao->getAttributeMapping();
-
-          SharedArrayBuffer posBuffer, normBuffer, uvBuffer;
-          bool hasPos = drawCall.geometry.vao->getBufferForAttribute("aPosition", posBuffer);
-          auto idxBuffer = drawCall.geometry.vao->getIdxBuffer();
-          bool hasNormals = drawCall.geometry.vao->getBufferForAttribute("aNormal", normBuffer);
-          bool hasUvs = drawCall.geometry.vao->getBufferForAttribute("aTexCoord", uvBuffer);
-
-          //We need at least positions, indices and normals
-          if (!hasPos || !idxBuffer) {
-              continue;
+          auto first = (GLint)(resident.primitiveOffset * 3);
+          auto count = (GLsizei)(resident.primitiveCount * 3);
+          if (!m_rasterFirsts.empty() && m_rasterFirsts.back() + m_rasterCounts.back() == first) {
+              m_rasterCounts.back() += count;
+          } else {
+              m_rasterFirsts.push_back(first);
+              m_rasterCounts.push_back(count);
           }
+          m_rasterizedDrawCalls++;
+      }
 
-          {
-              auto drawPrimCount = idxBuffer->getIndexCount() / 3;
-
-              glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, posBuffer->getObjectName());
-
-              if(hasNormals) {
-                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, normBuffer->getObjectName());
-              } else {
-                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
-              }
-
-              if(hasUvs) {
-                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, uvBuffer->getObjectName());
-              } else {
-                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
-              }
+      if (!m_rasterFirsts.empty()) {
+          auto boundVao = m_pullVertexArray->bind();
+          glMultiDrawArrays(GL_TRIANGLES, m_rasterFirsts.data(), m_rasterCounts.data(), (GLsizei)m_rasterFirsts.size());
+      }
+  }
 
-              glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, idxBuffer->getObjectName());
-              glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_primitiveBuffer->getObjectName());
+  // Only the pixels traced this frame get a thread, see Interleave.glsl
+  auto traceSize = renderSize;
+  if (m_interleave == 2) {
+      traceSize.x = (traceSize.x + 1) / 2;
+  } else if (m_interleave == 4) {
+      traceSize = (traceSize + 1) / 2;
+  }
 
-              boundCopyProgram.setUniform("sceneMin", glm::vec3(-100.0));
-              boundCopyProgram.setUniform("sceneMax", glm::vec3( 100.0));
+  {
+      RaycastPermutation permutation;
+      permutation.traceTier = m_traceTier;
+      permutation.maxBounces = m_maxBounces;
+      permutation.sampleCount = m_sampleCount;
+      permutation.materialTextures = m_materials.hasTextures();
+      permutation.depthOfField = cam->lensRadius > 0 && cam->focalDistance > 0;
+      permutation.bindlessTextures = m_textureTable.isBindless();
+      m_raycastComputeProgram = getRaycastProgram(permutation);
+  }
 
-              boundCopyProgram.setUniform("hasNormals", hasNormals);
-              boundCopyProgram.setUniform("hasUvs", hasUvs);
+  auto gBufferSize = G_BUFFER_SIZE[(int)m_quality];
+  auto colorSize = m_normalMotionBuffer->getDim();
 
-              boundCopyProgram.setUniform("materialId", (int)i);
-              boundCopyProgram.setUniform("model2World", drawCall.thisRenderTransform);
-              boundCopyProgram.setUniform("model2WorldInvTransp", glm::inverseTranspose(drawCall.thisRenderTransform));
-              boundCopyProgram.setUniform("currentPrimitiveCount", (int)drawPrimCount);
-              boundCopyProgram.setUniform("writeOffset", (int)totalPrimitiveCount);
-              boundCopyProgram.compute(drawPrimCount / 8 + 1);
+  if (m_restirEnabled) {
+      ensureReservoirs(pass, (size_t)colorSize.x * colorSize.y);
+      m_raycastComputeProgram->setShaderStorageBuffer("ReservoirBuffer", pass.reservoirs);
+      m_raycastComputeProgram->setShaderStorageBuffer("PrevReservoirBuffer", pass.prevReservoirs);
+  }
 
-              totalPrimitiveCount += drawPrimCount;
-          }
-      }
+  bool interleaveHistoryValid = pass.interleaveHistory && glm::ivec2(pass.interleaveHistory->getDim()) == glm::ivec2(colorSize);
+  if (m_interleave > 1 && !interleaveHistoryValid) {
+      pass.interleaveHistory = createScreenspaceTexture(gBufferSize, GL_RGBA32F);
   }
 
- /* {
-      int groupCount = 2;
-      int blockCount = groupCount * 8;
-      {
-          auto boundSortProgram = m_sortPrimitiveProgram->use();
-          boundSortProgram.setUniform("primitiveCount", (int)totalPrimitiveCount);
-          boundSortProgram.setUniform("groupCount", groupCount);
-          boundSortProgram.compute(groupCount);
-      }
+  // Screen space work of the pass. The tracer output and the sample weights
+  // only live until TXAA, everything else is imported for its barriers.
+  auto colorAttachment = [](const SharedFramebuffer& framebuffer, int index) {
+      return std::dynamic_pointer_cast<Texture2D>(framebuffer->getColorAttachments()[index].texture);
+  };
 
-      {
-          auto boundMergeProgram = m_mergePrimitiveProgram->use();
-          boundMergeProgram.setUniform("primitiveCount", (int)totalPrimitiveCount);
-          int mergeCount = log2i(blockCount);
-          for (int i = 0; i < mergeCount; i++) {
-              blockCount /= 2;
-              boundMergeProgram.setUniform("mergeLevel", i);
-              //boundMergeProgram.compute(blockCount);
+  auto& graph = m_renderGraph;
+  graph.reset();
+  auto tracedColor = graph.createTexture("Traced Color", gBufferSize, GL_RGBA32F);
+  auto sampleWeight = graph.createTexture("Sample Weight", gBufferSize, GL_R32F);
+  auto normalMotion = graph.importTexture("Normal Motion", m_normalMotionBuffer);
+  auto depth = graph.importTexture("Depth", m_depthBuffer);
+  auto visibility = graph.importTexture("Visibility", m_visibilityBuffer);
+  auto prevDepth = graph.importTexture("Previous Depth", colorAttachment(pass.prevDepthBuffer, 0));
+  auto history = graph.importTexture("TXAA History", colorAttachment(pass.txaaHistory, 0));
+  auto historyLength = graph.importTexture("TXAA History Length", colorAttachment(pass.txaaHistory, 1));
+  auto target = graph.importTexture("TXAA Target", colorAttachment(pass.compositingTarget, 0));
+  auto composited = graph.importTexture("Composited", colorAttachment(m_primaryCompositingBuffer, 0));
+  auto interleaveHistory = m_interleave > 1 ? graph.importTexture("Interleave History", pass.interleaveHistory) : -1;
+
+  if (m_adaptiveSampling) {
+      graph.addPass("Sample Allocation",
+                    { { historyLength, RenderGraphAccess::Sampled }, { normalMotion, RenderGraphAccess::Sampled },
+                      { depth, RenderGraphAccess::Sampled }, { prevDepth, RenderGraphAccess::Sampled } },
+                    { { sampleWeight, RenderGraphAccess::Image } },
+                    [&](RenderGraph& graph) {
+          {
+              auto boundBuffer = m_sampleAllocationBuffer->bind();
+              glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
           }
-      }
-  }*/
 
-  {
-      auto boundBuffer = m_materialDataBuffer->bind();
-      boundBuffer.setData(materials);
+          // After the swap last frame the history holds the most recent TXAA output
+          auto boundAllocationProgram = m_sampleAllocationProgram->use();
+          boundAllocationProgram.setUniform("uInterleave", m_interleave);
+          boundAllocationProgram.setUniform("uInterleavePhase", (int)(m_frameIndex % m_interleave));
+          boundAllocationProgram.setUniform("uRenderSize", renderSize);
+          boundAllocationProgram.setUniform("uNear", cam->near);
+          boundAllocationProgram.setUniform("uFar", cam->far);
+          boundAllocationProgram.setTexture("uSamplerHistoryLength", graph.getTexture(historyLength));
+          boundAllocationProgram.setTexture("uSamplerNormalMotion", m_normalMotionBuffer);
+          boundAllocationProgram.setTexture("uSamplerDepth", m_depthBuffer);
+          boundAllocationProgram.setTexture("uSamplerPrevDepth", graph.getTexture(prevDepth));
+          boundAllocationProgram.setImage(0, graph.getTexture(sampleWeight), GL_WRITE_ONLY);
+          boundAllocationProgram.compute(traceSize.x / 8 + 1, traceSize.y / 8 + 1);
+
+          // The graph only covers textures, the sample counts are a buffer
+          glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+      });
   }
 
-  {
-      std::vector<GPULight> lights;
-      for (size_t i = 0; i < pass.submittedLights.size(); i++) {
-          auto light = pass.submittedLights[i];
-
-          auto trans = interpolate(light.lastSimulateTransform, light.thisSimulateTransform, interp);
-          auto pos = glm::vec3(trans * glm::vec4{ 0, 0, 0, 1 });
-          lights.push_back({ pos, light.size, light.color });
-      }
+  std::vector<RenderGraphUse> traceReads;
+  if (m_adaptiveSampling) {
+      traceReads.push_back({ sampleWeight, RenderGraphAccess::Sampled });
+  }
+  if (m_restirEnabled) {
+      traceReads.push_back({ normalMotion, RenderGraphAccess::Sampled });
+  }
+  if (m_hybridPrimary) {
+      traceReads.push_back({ visibility, RenderGraphAccess::Sampled });
+  }
 
+  graph.addPass("Trace", traceReads, { { tracedColor, RenderGraphAccess::Image } }, [&](RenderGraph& graph) {
       {
-          auto boundBuffer = m_lightDataBuffer->bind();
-          boundBuffer.setData(lights);
-      }
-  }
+          auto boundRaycastProgram = m_raycastComputeProgram->use();
 
+          auto raycastProgramName = m_raycastComputeProgram->getObjectName();
+          camDataAllocation.bind(raycastProgramName, "CameraBuffer", m_uploadRingBinding);
+          pass.lights.bind(raycastProgramName, "LightBuffer", m_uploadRingBinding + 1);
+          m_drawPassMaskAllocation.bind(raycastProgramName, "DrawPassMaskBuffer", m_uploadRingBinding + 2);
 
+          m_textureTable.bind();
 
-  {
-      auto boundRaycastProgram = m_raycastComputeProgram->use();
+          if (m_restirEnabled) {
+              // Bound by hand so it can't collide with the material texture units
+              glActiveTexture(GL_TEXTURE0 + RESTIR_MOTION_TEXTURE_UNIT);
+              glBindTexture(GL_TEXTURE_2D, m_normalMotionBuffer->getObjectName());
+              glActiveTexture(GL_TEXTURE0);
+              boundRaycastProgram.setUniform("uSamplerNormalMotion", RESTIR_MOTION_TEXTURE_UNIT);
+          }
 
-      glBindTextures(0, knowTextures.size(), knowTextures.data());
+          if (m_adaptiveSampling) {
+              glActiveTexture(GL_TEXTURE0 + SAMPLE_WEIGHT_TEXTURE_UNIT);
+              glBindTexture(GL_TEXTURE_2D, graph.getTexture(sampleWeight)->getObjectName());
+              glActiveTexture(GL_TEXTURE0);
+              boundRaycastProgram.setUniform("uSamplerSampleWeight", SAMPLE_WEIGHT_TEXTURE_UNIT);
+          }
 
-      for (int i = 0; i < knowTextures.size(); i++) {
-          boundRaycastProgram.setUniform("materialTextures[" + std::to_string(i) + "]", i);
-      }
+          if (m_hybridPrimary) {
+              glActiveTexture(GL_TEXTURE0 + VISIBILITY_TEXTURE_UNIT);
+              glBindTexture(GL_TEXTURE_2D, m_visibilityBuffer->getObjectName());
+              glActiveTexture(GL_TEXTURE0);
+              boundRaycastProgram.setUniform("uSamplerVisibility", VISIBILITY_TEXTURE_UNIT);
+          }
 
-      boundRaycastProgram.setUniform("pixelOffset", glm::vec2(currentOffset));
-      boundRaycastProgram.setUniform("primitiveCount", (int)totalPrimitiveCount);
-      boundRaycastProgram.setUniform("lightCount", (int)pass.submittedLights.size());
-      boundRaycastProgram.setUniform("totalTime", (float)totalTime);
-      boundRaycastProgram.setImage(0, m_secondaryCompositingBuffer->getColorAttachments()[0].texture, GL_WRITE_ONLY);
+          boundRaycastProgram.setUniform("pixelOffset", glm::vec2(currentOffset));
+          boundRaycastProgram.setUniform("uRenderSize", renderSize);
+          boundRaycastProgram.setUniform("uPrevRenderSize", pass.lastRenderSize);
+          boundRaycastProgram.setUniform("primitiveCount", (int)m_scenePrimitiveCount);
+          boundRaycastProgram.setUniform("lightCount", (int)pass.lightCount);
+          boundRaycastProgram.setUniform("uPassMask", passBit);
+          boundRaycastProgram.setUniform("uWholeScene", (m_passesWithAllDrawCalls & passBit) != 0);
+          // Passes seeing part of the scene must not share cached radiance
+          // with the others
+          boundRaycastProgram.setUniform("uRadianceCacheScene",
+                                         (m_passesWithAllDrawCalls & passBit) ? 0u : cam->renderPassIndex + 1);
+          boundRaycastProgram.setUniform("totalTime", (float)totalTime);
+          boundRaycastProgram.setUniform("uFrameIndex", (uint32_t)m_frameIndex);
+          boundRaycastProgram.setUniform("uInterleavePhase", (int)(m_frameIndex % m_interleave));
+          boundRaycastProgram.setImage(0, graph.getTexture(tracedColor), GL_WRITE_ONLY);
+
+          if (m_persistentThreads) {
+              // Reset the work queue, the resident groups pull pixels until it runs dry
+              {
+                  auto boundQueue = m_workQueueBuffer->bind();
+                  glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+              }
+              glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+              boundRaycastProgram.compute(m_persistentGroupCount);
+          } else {
+              boundRaycastProgram.compute(traceSize.x / 8 + 1, traceSize.y / 8 + 1);
+          }
+      }
+  });
 
-      auto compositingSize = m_primaryCompositingBuffer->getDim();
-      boundRaycastProgram.compute(compositingSize.x / 8 + 1, compositingSize.y / 8 + 1);
+  if (m_interleave > 1) {
+      graph.addPass("Reconstruct",
+                    { { interleaveHistory, RenderGraphAccess::Sampled }, { normalMotion, RenderGraphAccess::Sampled },
+                      { depth, RenderGraphAccess::Sampled }, { prevDepth, RenderGraphAccess::Sampled },
+                      { tracedColor, RenderGraphAccess::Image } },
+                    { { tracedColor, RenderGraphAccess::Image } },
+                    [&](RenderGraph& graph) {
+          auto boundReconstructProgram = m_reconstructProgram->use();
+          boundReconstructProgram.setUniform("uInterleave", m_interleave);
+          boundReconstructProgram.setUniform("uInterleavePhase", (int)(m_frameIndex % m_interleave));
+          boundReconstructProgram.setUniform("uHistoryValid", interleaveHistoryValid);
+          boundReconstructProgram.setUniform("uRenderSize", renderSize);
+          boundReconstructProgram.setUniform("uPrevRenderSize", pass.lastRenderSize);
+          boundReconstructProgram.setUniform("uNear", cam->near);
+          boundReconstructProgram.setUniform("uFar", cam->far);
+          boundReconstructProgram.setTexture("uSamplerHistory", pass.interleaveHistory);
+          boundReconstructProgram.setTexture("uSamplerNormalMotion", m_normalMotionBuffer);
+          boundReconstructProgram.setTexture("uSamplerDepth", m_depthBuffer);
+          boundReconstructProgram.setTexture("uSamplerPrevDepth", graph.getTexture(prevDepth));
+          boundReconstructProgram.setImage(0, graph.getTexture(tracedColor), GL_READ_WRITE);
+          boundReconstructProgram.compute(renderSize.x / 8 + 1, renderSize.y / 8 + 1);
+      });
+
+      // Keep the full frame as history before anything filters it
+      graph.addPass("Interleave History", { { tracedColor, RenderGraphAccess::Copy } },
+                    { { interleaveHistory, RenderGraphAccess::Copy } },
+                    [&](RenderGraph& graph) {
+          glCopyImageSubData(graph.getTexture(tracedColor)->getObjectName(), GL_TEXTURE_2D, 0, 0, 0, 0,
+                             pass.interleaveHistory->getObjectName(), GL_TEXTURE_2D, 0, 0, 0, 0,
+                             renderSize.x, renderSize.y, 1);
+      });
   }
 
-  glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-  // TXAA
-  
-  glDisable(GL_BLEND);
+  if (m_svgf->enabled) {
+      graph.addPass("SVGF",
+                    { { tracedColor, RenderGraphAccess::Sampled }, { normalMotion, RenderGraphAccess::Sampled },
+                      { depth, RenderGraphAccess::Sampled } },
+                    { { tracedColor, RenderGraphAccess::Image } },
+                    [&](RenderGraph& graph) {
+          m_svgf->setGuides(m_normalMotionBuffer, m_depthBuffer, cam->near, cam->far,
+                            renderSize, pass.lastRenderSize, &pass.svgfHistory);
+          m_svgf->apply(graph.getTexture(tracedColor), graph.getFramebuffer(tracedColor));
+      });
+  }
 
   // attribute-less rendering:
   auto vao = VertexArray::create(GL_TRIANGLE_STRIP);
   auto boundVAO = vao->bind(); // 'empty' VAO -> no attributes are defined
 
-  {
+  // TXAA
+  graph.addPass("TXAA",
+                { { tracedColor, RenderGraphAccess::Sampled }, { history, RenderGraphAccess::Sampled },
+                  { historyLength, RenderGraphAccess::Sampled }, { normalMotion, RenderGraphAccess::Sampled },
+                  { depth, RenderGraphAccess::Sampled }, { prevDepth, RenderGraphAccess::Sampled } },
+                { { target, RenderGraphAccess::RenderTarget } },
+                [&](RenderGraph& graph) {
+      glDisable(GL_BLEND);
+
       auto boundFB = pass.compositingTarget->bind();
       int width = pass.compositingTarget->getDim().x;
       int height = pass.compositingTarget->getDim().y;
       glViewport(0, 0, width, height);
 
       auto boundTxaaProg = m_txaaProg->use();
-      boundTxaaProg.setTexture(
-          "uSamplerColor",
-          m_secondaryCompositingBuffer->getColorAttachments()[0].texture);
+      boundTxaaProg.setTexture("uSamplerColor", graph.getTexture(tracedColor));
 
-      boundTxaaProg.setTexture("uSamplerHistory",
-          pass.txaaHistory->getColorAttachments()[0].texture);
+      boundTxaaProg.setTexture("uSamplerHistory", graph.getTexture(history));
+      boundTxaaProg.setTexture("uSamplerHistoryLength", graph.getTexture(historyLength));
+      boundTxaaProg.setUniform("uNear", cam->near);
+      boundTxaaProg.setUniform("uFar", cam->far);
 
       boundTxaaProg.setTexture("uSamplerNormalMotion", m_normalMotionBuffer);
       boundTxaaProg.setTexture("uSamplerDepth", m_depthBuffer);
-      boundTxaaProg.setTexture("uSamplerPrevDepth", pass.prevDepthBuffer->getColorAttachments()[0].texture);
+      boundTxaaProg.setTexture("uSamplerPrevDepth", graph.getTexture(prevDepth));
 
-      auto colorSize = glm::vec2(m_secondaryCompositingBuffer->getDim());
-      boundTxaaProg.setUniform("uOneOverColorSize", glm::vec2(1.0) / colorSize);
+      // TXAA resolves the render size back up to the full target
+      auto tracedSize = glm::vec2(colorSize);
+      boundTxaaProg.setUniform("uOneOverColorSize", glm::vec2(1.0) / tracedSize);
+      boundTxaaProg.setUniform("uRenderScale", glm::vec2(renderSize) / tracedSize);
 
       auto motionSize = glm::vec2(m_normalMotionBuffer->getDim());
       boundTxaaProg.setUniform("uOneOverMotionSize", glm::vec2(1.0) / motionSize);
 
       boundVAO.drawRange(0, 4);
-  }
-
+  });
 
-  // Copy Depth
-  {
+  graph.addPass("Copy Depth", { { depth, RenderGraphAccess::Sampled } },
+                { { prevDepth, RenderGraphAccess::RenderTarget } },
+                [&](RenderGraph& graph) {
       auto depthSize = pass.prevDepthBuffer->getDim();
       glViewport(0, 0, depthSize.x, depthSize.y);
       glDisable(GL_BLEND);
@@ -534,31 +1372,41 @@ void RendererSystem::render(RenderPass& pass, double interp, double totalTime) {
       boundPassBlitProgram.setTexture(
           "uSamplerColor",
           m_depthBuffer);
+      boundPassBlitProgram.setUniform("uTexCoordScale", glm::vec2(renderSize) / glm::vec2(m_depthBuffer->getDim()));
 
       boundVAO.drawRange(0, 4);
-  }
-
+  });
 
   if (!pass.renderToTextureOnly) {
-    auto compositingSize = m_primaryCompositingBuffer->getDim();
-    glViewport(0, 0, compositingSize.x, compositingSize.y);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glEnable(GL_BLEND);
+    graph.addPass("Composite", { { target, RenderGraphAccess::Sampled } },
+                  { { composited, RenderGraphAccess::RenderTarget } },
+                  [&](RenderGraph& graph) {
+      auto compositingSize = m_primaryCompositingBuffer->getDim();
+      glViewport(0, 0, compositingSize.x, compositingSize.y);
+      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+      glEnable(GL_BLEND);
 
-    auto boundFrameBuffer = m_primaryCompositingBuffer->bind();
-    auto boundPassBlitProgram = m_passBlitProgram->use();
-    boundPassBlitProgram.setTexture(
-        "uSamplerColor",
-        pass.compositingTarget->getColorAttachments()[0].texture);
+      auto boundFrameBuffer = m_primaryCompositingBuffer->bind();
+      auto boundPassBlitProgram = m_passBlitProgram->use();
+      boundPassBlitProgram.setTexture("uSamplerColor", graph.getTexture(target));
+      boundPassBlitProgram.setUniform("uTexCoordScale", glm::vec2(1.0f));
 
-    boundVAO.drawRange(0, 4);
+      boundVAO.drawRange(0, 4);
+    });
   }
 
+  graph.execute();
+
   // Swap TAA buffers
   auto temp = pass.compositingTarget;
   pass.compositingTarget = pass.txaaHistory;
   pass.txaaHistory = temp;
 
+  // Swap ReSTIR reservoirs
+  std::swap(pass.reservoirs, pass.prevReservoirs);
+
+  pass.lastRenderSize = renderSize;
+
   trans->lastRenderTransform = static_cast<glm::dmat4>(camTransform);
 }
 
@@ -568,17 +1416,54 @@ void RendererSystem::frame(double interp, double totalTime) {
 
   m_frameIndex++;
 
+  // Timer results arrive a few frames late, the profiler reads back the
+  // oldest frame in flight if the GPU is done with it
+  float frameTimeMs = 0;
+  if (m_gpuProfiler.beginFrame() && m_gpuProfiler.lastTime("Frame", frameTimeMs)) {
+    m_gpuFrameTimeMs = m_gpuFrameTimeMs > 0 ? glm::mix(m_gpuFrameTimeMs, frameTimeMs, 0.1f) : frameTimeMs;
+    updateResolutionScale();
+  }
+  m_gpuProfiler.begin("Frame");
+
+  m_uploadRing.beginFrame();
+
+  bool anyPassActive = false;
+  for (auto& pass : m_passes) {
+    anyPassActive |= pass.active;
+  }
+
+  rmt_BeginOpenGLSample(PrepareScene);
+  rmt_BeginCPUSample(PrepareScene, 0);
+  if (anyPassActive) {
+    GpuProfilerScope prepareScope(m_gpuProfiler, "Prepare Scene");
+    prepareScene(interp);
+  }
+  rmt_EndCPUSample();
+  rmt_EndOpenGLSample();
+
   rmt_BeginOpenGLSample(RenderPasses);
   rmt_BeginCPUSample(RenderPasses, 0);
-  for (auto& pass : m_passes) {
+  for (size_t i = 0; i < m_passes.size(); i++) {
     rmt_ScopedCPUSample(DrawPass, 0);
-    if (pass.active) {
-      render(pass, interp, totalTime);
+    if (m_passes[i].active) {
+      GpuProfilerScope passScope(m_gpuProfiler, "Pass " + std::to_string(i));
+      render(m_passes[i], interp, totalTime);
     }
-    pass.submittedDrawCallsOpaque.reset();
-    pass.submittedDrawCallsTransparent.reset();
-    pass.submittedLights.reset();
   }
+
+  // Ages and evicts once per frame no matter how many passes trained it
+  if (anyPassActive && m_radianceCacheEnabled) {
+    GpuProfilerScope cacheScope(m_gpuProfiler, "Radiance Cache Update");
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    auto boundCacheProgram = m_radianceCacheUpdateProgram->use();
+    boundCacheProgram.setUniform("uFrameIndex", (uint32_t)m_frameIndex);
+    boundCacheProgram.setUniform("uMaxSamples", (uint32_t)std::max(1, m_radianceCacheMaxSamples));
+    boundCacheProgram.setUniform("uMaxAge", (uint32_t)std::max(1, m_radianceCacheMaxAge));
+    boundCacheProgram.compute(RADIANCE_CACHE_SIZE / 256);
+  }
+  m_submittedDrawCalls.reset();
+  m_submittedLights.reset();
   rmt_EndCPUSample();
   rmt_EndOpenGLSample();
 
@@ -590,33 +1475,40 @@ void RendererSystem::frame(double interp, double totalTime) {
 
   rmt_BeginOpenGLSample(PostFX);
   rmt_BeginCPUSample(PostFX, 0);
+  m_gpuProfiler.begin("PostFX");
+  // Every effect writes a new transient, so the composited frame stays
+  // intact and two effects apart share a texture
+  m_renderGraph.reset();
+  auto postfxInput = m_renderGraph.importTexture(
+      "Composited", std::dynamic_pointer_cast<Texture2D>(m_primaryCompositingBuffer->getColorAttachments()[0].texture));
   for (auto& fx : m_effects) {
-    fx->apply(std::dynamic_pointer_cast<Texture2D>(m_primaryCompositingBuffer->getColorAttachments()[0].texture), m_postfxTargetBuffer);
-    
-    auto temp = m_primaryCompositingBuffer;
-    m_primaryCompositingBuffer = m_postfxTargetBuffer;
-    m_postfxTargetBuffer = temp;
+    auto postfxOutput = m_renderGraph.createTexture("PostFX Output", G_BUFFER_SIZE[(int)m_quality], GL_RGBA32F);
+    fx->declare(m_renderGraph, postfxInput, postfxOutput);
+    postfxInput = postfxOutput;
   }
-  rmt_EndCPUSample();
-  rmt_EndOpenGLSample();
 
-  rmt_BeginOpenGLSample(Blit);
-  rmt_BeginCPUSample(Blit, 0);
-  glViewport(0, 0, m_window->getSize().x, m_window->getSize().y);
   // Blit to backbuffer with tonemapping
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
-  glDisable(GL_DEPTH_TEST);
-
-  auto boundBlitProgram = m_blitProgram->use();
-  boundBlitProgram.setTexture(
-      "uSamplerColor",
-      m_primaryCompositingBuffer->getColorAttachments()[0].texture);
+  m_renderGraph.addPass("Blit", { { postfxInput, RenderGraphAccess::Sampled } }, {},
+                        [&](RenderGraph& graph) {
+    glViewport(0, 0, m_window->getSize().x, m_window->getSize().y);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDisable(GL_DEPTH_TEST);
 
-  boundVAO.drawRange(0, 4);
+    auto boundBlitProgram = m_blitProgram->use();
+    boundBlitProgram.setTexture("uSamplerColor", graph.getTexture(postfxInput));
 
+    boundVAO.drawRange(0, 4);
+  });
+  m_renderGraph.execute();
+  m_renderGraph.endFrame();
+  m_gpuProfiler.end();
   rmt_EndCPUSample();
   rmt_EndOpenGLSample();
 
+  m_gpuProfiler.end();
+  m_gpuProfiler.endFrame();
+  m_uploadRing.endFrame();
+
   rmt_EndCPUSample();
   rmt_EndOpenGLSample();
 }
@@ -625,5 +1517,9 @@ void RendererSystem::shutdown() {
   for (auto& fx : m_effects) {
     fx->shutdown();
   }
+  m_svgf->shutdown();
+  m_gpuProfiler.destroy();
+  m_uploadRing.destroy();
+  m_textureTable.destroy();
 }
 
@@ -0,0 +1,154 @@
+#include <engine/graphics/SVGFPostFX.hpp>
+#include <engine/graphics/RendererSystem.hpp>
+#include <engine/ui/imgui.h>
+#include <glow/objects/Framebuffer.hh>
+#include <glow/objects/Program.hh>
+#include <glow/objects/Texture2D.hh>
+
+#include <algorithm>
+
+using namespace glow;
+
+static SharedTexture2D createFilterTexture(int width, int height) {
+  auto tex = Texture2D::create(width, height, GL_RGBA32F);
+
+  auto boundTex = tex->bind();
+  boundTex.setMinFilter(GL_NEAREST);
+  boundTex.setMagFilter(GL_NEAREST);
+  boundTex.setWrap(GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
+  boundTex.makeStorageImmutable(width, height, GL_RGBA32F);
+  return tex;
+}
+
+void SVGFPostFX::startup() {
+  enabled = false;
+  m_history = nullptr;
+
+  m_reprojectProgram = Program::createFromFile("compute/svgf/Reproject.csh");
+  m_varianceProgram = Program::createFromFile("compute/svgf/Variance.csh");
+  m_atrousProgram = Program::createFromFile("compute/svgf/Atrous.csh");
+}
+
+void SVGFPostFX::setGuides(SharedTexture2D normalMotion, SharedTexture2D depth,
+                           float near, float far, glm::ivec2 renderSize, glm::ivec2 prevRenderSize,
+                           SVGFHistory* history) {
+  m_normalMotion = normalMotion;
+  m_depth = depth;
+  m_near = near;
+  m_far = far;
+  m_renderSize = renderSize;
+  m_prevRenderSize = prevRenderSize;
+  m_history = history;
+}
+
+void SVGFPostFX::ensureTextures(int width, int height) {
+  if (!m_filterTextures[0] || m_filterTextures[0]->getWidth() != width ||
+      m_filterTextures[0]->getHeight() != height) {
+    m_filterTextures[0] = createFilterTexture(width, height);
+    m_filterTextures[1] = createFilterTexture(width, height);
+  }
+
+  auto& history = *m_history;
+  if (!history.color[0] || history.color[0]->getWidth() != width ||
+      history.color[0]->getHeight() != height) {
+    for (int i = 0; i < 2; i++) {
+      history.color[i] = createFilterTexture(width, height);
+      history.moments[i] = createFilterTexture(width, height);
+      history.normalDepth[i] = createFilterTexture(width, height);
+    }
+    history.current = 0;
+    history.valid = false;
+  }
+}
+
+void SVGFPostFX::apply(SharedTexture2D inputBuffer, SharedFramebuffer outputBuffer) {
+  if (!m_history) {
+    return;
+  }
+
+  int width = inputBuffer->getWidth();
+  int height = inputBuffer->getHeight();
+  ensureTextures(width, height);
+
+  auto& history = *m_history;
+  int prev = history.current;
+  int curr = 1 - prev;
+  int groupsX = m_renderSize.x / 8 + 1;
+  int groupsY = m_renderSize.y / 8 + 1;
+
+  // Temporal accumulation
+  {
+    auto boundProgram = m_reprojectProgram->use();
+    boundProgram.setUniform("uNear", m_near);
+    boundProgram.setUniform("uFar", m_far);
+    boundProgram.setUniform("uRenderSize", m_renderSize);
+    boundProgram.setUniform("uPrevRenderSize", m_prevRenderSize);
+    boundProgram.setUniform("uHistoryValid", history.valid);
+    boundProgram.setUniform("uColorAlpha", m_colorAlpha);
+    boundProgram.setUniform("uMomentsAlpha", m_momentsAlpha);
+    boundProgram.setTexture("uSamplerColor", inputBuffer);
+    boundProgram.setTexture("uSamplerNormalMotion", m_normalMotion);
+    boundProgram.setTexture("uSamplerDepth", m_depth);
+    boundProgram.setTexture("uSamplerPrevColor", history.color[prev]);
+    boundProgram.setTexture("uSamplerPrevMoments", history.moments[prev]);
+    boundProgram.setTexture("uSamplerPrevNormalDepth", history.normalDepth[prev]);
+    boundProgram.setImage(0, history.color[curr], GL_WRITE_ONLY);
+    boundProgram.setImage(1, history.moments[curr], GL_WRITE_ONLY);
+    boundProgram.setImage(2, history.normalDepth[curr], GL_WRITE_ONLY);
+    boundProgram.compute(groupsX, groupsY);
+  }
+  glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+  // Variance estimation
+  {
+    auto boundProgram = m_varianceProgram->use();
+    boundProgram.setUniform("uRenderSize", m_renderSize);
+    boundProgram.setUniform("uPhiNormal", m_phiNormal);
+    boundProgram.setTexture("uSamplerColor", history.color[curr]);
+    boundProgram.setTexture("uSamplerMoments", history.moments[curr]);
+    boundProgram.setTexture("uSamplerNormalDepth", history.normalDepth[curr]);
+    boundProgram.setImage(0, m_filterTextures[0], GL_WRITE_ONLY);
+    boundProgram.compute(groupsX, groupsY);
+  }
+  glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+  // Wavelet iterations, ping-ponging between the filter textures
+  auto output = std::dynamic_pointer_cast<Texture2D>(outputBuffer->getColorAttachments()[0].texture);
+  {
+    auto boundProgram = m_atrousProgram->use();
+    boundProgram.setUniform("uRenderSize", m_renderSize);
+    boundProgram.setUniform("uPhiColor", m_phiColor);
+    boundProgram.setUniform("uPhiNormal", m_phiNormal);
+    boundProgram.setUniform("uPhiDepth", m_phiDepth);
+    boundProgram.setTexture("uSamplerNormalDepth", history.normalDepth[curr]);
+    boundProgram.setImage(1, history.color[curr], GL_READ_WRITE);
+
+    int iterations = std::max(1, m_iterations);
+    for (int i = 0; i < iterations; i++) {
+      bool last = i == iterations - 1;
+
+      boundProgram.setUniform("uStepSize", 1 << i);
+      boundProgram.setUniform("uWriteHistory", i == 0);
+      boundProgram.setUniform("uFinalIteration", last);
+      boundProgram.setTexture("uSamplerInput", m_filterTextures[i % 2]);
+      boundProgram.setImage(0, last ? output : m_filterTextures[(i + 1) % 2], GL_WRITE_ONLY);
+      boundProgram.compute(groupsX, groupsY);
+      glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+    }
+  }
+
+  history.current = curr;
+  history.valid = true;
+}
+
+void SVGFPostFX::drawUI() {
+  ImGui::InputInt("SVGF Iterations", &m_iterations);
+  ImGui::SliderFloat("SVGF Color Alpha", &m_colorAlpha, 0.01f, 1.0f);
+  ImGui::SliderFloat("SVGF Moments Alpha", &m_momentsAlpha, 0.01f, 1.0f);
+  ImGui::SliderFloat("SVGF Phi Color", &m_phiColor, 0.1f, 32.0f);
+  ImGui::SliderFloat("SVGF Phi Normal", &m_phiNormal, 1.0f, 256.0f);
+  ImGui::SliderFloat("SVGF Phi Depth", &m_phiDepth, 0.1f, 8.0f);
+}
+
+void SVGFPostFX::shutdown() {
+}
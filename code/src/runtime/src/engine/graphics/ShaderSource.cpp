@@ -0,0 +1,54 @@
+#include <engine/graphics/ShaderSource.hpp>
+#include <glow/common/log.hh>
+
+#include <fstream>
+#include <set>
+#include <sstream>
+
+static std::string directoryOf(const std::string& path) {
+  auto slash = path.find_last_of("/\\");
+  return slash == std::string::npos ? "" : path.substr(0, slash + 1);
+}
+
+static bool expand(const std::string& path, std::set<std::string>& included, std::string& out) {
+  if (!included.insert(path).second) {
+    return true;
+  }
+
+  std::ifstream file(path);
+  if (!file) {
+    glow::error() << "Could not read shader " << path << "\n";
+    return false;
+  }
+
+  std::string line;
+  while (std::getline(file, line)) {
+    auto directive = line.find_first_not_of(" \t");
+    if (directive != std::string::npos && line.compare(directive, 8, "#include") == 0) {
+      auto open = line.find('"', directive + 8);
+      auto close = open == std::string::npos ? open : line.find('"', open + 1);
+      if (close == std::string::npos) {
+        glow::error() << "Malformed #include in " << path << ": " << line << "\n";
+        return false;
+      }
+
+      if (!expand(directoryOf(path) + line.substr(open + 1, close - open - 1), included, out)) {
+        return false;
+      }
+      continue;
+    }
+
+    out += line;
+    out += "\n";
+  }
+  return true;
+}
+
+std::string expandShaderIncludes(const std::string& path) {
+  std::set<std::string> included;
+  std::string source;
+  if (!expand(path, included, source)) {
+    return "";
+  }
+  return source;
+}
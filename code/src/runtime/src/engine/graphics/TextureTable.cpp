@@ -0,0 +1,164 @@
+#include <engine/graphics/TextureTable.hpp>
+#include <glow/objects/Texture2D.hh>
+#include <glow/objects/ShaderStorageBuffer.hh>
+#include <glow/common/log.hh>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace glow;
+
+void TextureTable::create(bool bindless) {
+#ifdef GL_ARB_bindless_texture
+  m_bindless = bindless;
+#else
+  m_bindless = false;
+#endif
+  m_entryBuffer = ShaderStorageBuffer::create();
+
+  // Never empty, an empty range can't be bound
+  auto boundBuffer = m_entryBuffer->bind();
+  boundBuffer.setData(std::vector<glm::uvec2>(1, glm::uvec2(0)), GL_STATIC_DRAW);
+}
+
+void TextureTable::destroy() {
+#ifdef GL_ARB_bindless_texture
+  if (m_bindless) {
+    for (auto& entry : m_entries) {
+      glMakeTextureHandleNonResidentARB(GLuint64(entry.x) | (GLuint64(entry.y) << 32));
+    }
+  }
+#endif
+
+  for (auto& array : m_arrays) {
+    glDeleteTextures(1, &array.texture);
+  }
+
+  m_arrays.clear();
+  m_arrayNames.clear();
+  m_entries.clear();
+  m_indices.clear();
+  m_textures.clear();
+}
+
+uint32_t TextureTable::indexOf(const SharedTexture2D& tex) {
+  if (!tex) {
+    return NO_TEXTURE;
+  }
+
+  auto it = m_indices.find(tex->getObjectName());
+  return it != m_indices.end() ? it->second : add(tex);
+}
+
+uint32_t TextureTable::add(const SharedTexture2D& tex) {
+  auto it = m_indices.find(tex->getObjectName());
+  if (it != m_indices.end()) {
+    return it->second;
+  }
+
+  glm::uvec2 entry;
+#ifdef GL_ARB_bindless_texture
+  if (m_bindless) {
+    GLuint64 handle = glGetTextureHandleARB(tex->getObjectName());
+    glMakeTextureHandleResidentARB(handle);
+    entry = glm::uvec2(uint32_t(handle), uint32_t(handle >> 32));
+  } else
+#endif
+  if (!addToArray(tex->getObjectName(), entry)) {
+    return NO_TEXTURE;
+  }
+
+  auto index = (uint32_t)m_entries.size();
+  m_entries.push_back(entry);
+  m_indices[tex->getObjectName()] = index;
+  m_textures.push_back(tex);
+
+  auto boundBuffer = m_entryBuffer->bind();
+  boundBuffer.setData(m_entries, GL_STATIC_DRAW);
+  return index;
+}
+
+bool TextureTable::addToArray(GLuint texture, glm::uvec2& entry) {
+  GLint width = 0, height = 0, internalFormat = 0;
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+  glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+  glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  auto match = std::find_if(m_arrays.begin(), m_arrays.end(), [&](const TextureArray& array) {
+    return array.width == width && array.height == height && array.internalFormat == internalFormat;
+  });
+
+  if (match == m_arrays.end()) {
+    if (m_arrays.size() == MAX_TEXTURE_ARRAYS) {
+      error() << "TextureTable: more than " << MAX_TEXTURE_ARRAYS
+              << " texture sizes or formats, texture " << texture << " is not used";
+      return false;
+    }
+
+    m_arrays.push_back({ 0, width, height, internalFormat, 0 });
+    m_arrayNames.push_back(0);
+    match = m_arrays.end() - 1;
+  }
+
+  auto arrayIndex = match - m_arrays.begin();
+  auto layer = match->layers;
+  growArray(*match, layer + 1);
+  m_arrayNames[arrayIndex] = match->texture;
+
+  glCopyImageSubData(texture, GL_TEXTURE_2D, 0, 0, 0, 0,
+                     match->texture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer,
+                     width, height, 1);
+
+  glBindTexture(GL_TEXTURE_2D_ARRAY, match->texture);
+  glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+  entry = glm::uvec2(arrayIndex, layer);
+  return true;
+}
+
+void TextureTable::growArray(TextureArray& array, GLsizei layers) {
+  // Arrays double in layers so adding textures one by one stays cheap
+  GLint capacity = 0;
+  if (array.texture) {
+    glBindTexture(GL_TEXTURE_2D_ARRAY, array.texture);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D_ARRAY, 0, GL_TEXTURE_DEPTH, &capacity);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  }
+
+  if (layers <= capacity) {
+    array.layers = layers;
+    return;
+  }
+
+  auto levels = (GLsizei)std::floor(std::log2(std::max(array.width, array.height))) + 1;
+  auto newCapacity = std::max<GLsizei>(layers, capacity * 2);
+
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+  glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, array.internalFormat, array.width, array.height, newCapacity);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+  if (array.texture) {
+    glCopyImageSubData(array.texture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+                       texture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+                       array.width, array.height, array.layers);
+    glDeleteTextures(1, &array.texture);
+  }
+
+  array.texture = texture;
+  array.layers = layers;
+}
+
+void TextureTable::bind() const {
+  if (!m_arrayNames.empty()) {
+    glBindTextures(0, (GLsizei)m_arrayNames.size(), m_arrayNames.data());
+  }
+}
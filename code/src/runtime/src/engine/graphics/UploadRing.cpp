@@ -0,0 +1,156 @@
+#include <engine/graphics/UploadRing.hpp>
+#include <glow/common/log.hh>
+
+#include <algorithm>
+
+using namespace glow;
+
+void UploadRing::Allocation::bind(GLuint program, const char* blockName, GLuint binding) const {
+  GLuint index = glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BLOCK, blockName);
+  if (index == GL_INVALID_INDEX) {
+    return;
+  }
+
+  glShaderStorageBlockBinding(program, index, binding);
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, buffer, offset, size);
+}
+
+void UploadRing::create(size_t regionSize) {
+  GLint major = 0, minor = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &major);
+  glGetIntegerv(GL_MINOR_VERSION, &minor);
+  m_persistent = major > 4 || (major == 4 && minor >= 4);
+
+  GLint alignment = 0;
+  glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  m_alignment = std::max<size_t>(alignment, 16);
+
+  GLint maxBindings = 0;
+  glGetIntegerv(GL_MAX_SHADER_STORAGE_BUFFER_BINDINGS, &maxBindings);
+  m_maxBindings = (GLuint)std::max(maxBindings, 8);
+
+  createBuffer(regionSize);
+  if (!m_persistent) {
+    info() << "UploadRing: buffer storage needs GL 4.4, falling back to glBufferSubData";
+  }
+}
+
+bool UploadRing::reserveBindings(GLuint lowest, GLuint count, GLuint& first) const {
+  first = lowest;
+  if (lowest + count > m_maxBindings) {
+    error() << "UploadRing: needs storage buffer bindings " << lowest << " to " << lowest + count - 1
+            << ", the driver only has " << m_maxBindings;
+    return false;
+  }
+  return true;
+}
+
+void UploadRing::createBuffer(size_t regionSize) {
+  m_regionSize = (regionSize + m_alignment - 1) / m_alignment * m_alignment;
+  size_t totalSize = m_regionSize * FRAMES_IN_FLIGHT;
+
+  glGenBuffers(1, &m_buffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+  if (m_persistent) {
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_COPY_WRITE_BUFFER, totalSize, nullptr, flags);
+    m_mapped = (uint8_t*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, totalSize, flags);
+  } else {
+    glBufferData(GL_COPY_WRITE_BUFFER, totalSize, nullptr, GL_STREAM_DRAW);
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void UploadRing::releaseBuffer() {
+  for (auto& fence : m_fences) {
+    if (fence) {
+      glDeleteSync(fence);
+      fence = nullptr;
+    }
+  }
+
+  if (m_mapped) {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    m_mapped = nullptr;
+  }
+}
+
+void UploadRing::destroy() {
+  releaseBuffer();
+  glDeleteBuffers(1, &m_buffer);
+  m_buffer = 0;
+
+  for (auto& retired : m_retired) {
+    glDeleteBuffers(1, &retired.buffer);
+  }
+  m_retired.clear();
+}
+
+void UploadRing::beginFrame() {
+  m_region = (m_region + 1) % FRAMES_IN_FLIGHT;
+  m_offset = 0;
+
+  auto& fence = m_fences[m_region];
+  if (fence) {
+    // The flush makes sure the fence is submitted before blocking on it
+    if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+      m_fenceWaits++;
+      glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+    }
+    glDeleteSync(fence);
+    fence = nullptr;
+  }
+
+  for (auto& retired : m_retired) {
+    if (--retired.framesLeft <= 0) {
+      glDeleteBuffers(1, &retired.buffer);
+    }
+  }
+  m_retired.erase(std::remove_if(m_retired.begin(), m_retired.end(),
+                                 [](const RetiredBuffer& retired) { return retired.framesLeft <= 0; }),
+                  m_retired.end());
+}
+
+void UploadRing::endFrame() {
+  auto& fence = m_fences[m_region];
+  if (fence) {
+    glDeleteSync(fence);
+  }
+  fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+UploadRing::Allocation UploadRing::allocate(const void* data, size_t bytes) {
+  // Empty ranges can't be bound
+  size_t size = (std::max<size_t>(bytes, 1) + m_alignment - 1) / m_alignment * m_alignment;
+
+  if (m_offset + size > m_regionSize) {
+    // Pieces handed out earlier this frame stay valid in the old buffer
+    warning() << "UploadRing: " << m_offset + size << " bytes needed this frame, growing the "
+              << m_regionSize << " byte regions";
+    releaseBuffer();
+    m_retired.push_back({ m_buffer, FRAMES_IN_FLIGHT + 1 });
+    createBuffer(std::max(m_regionSize * 2, m_offset + size));
+    m_offset = 0;
+  }
+
+  Allocation allocation;
+  allocation.buffer = m_buffer;
+  allocation.offset = m_region * m_regionSize + m_offset;
+  allocation.size = size;
+
+  if (bytes > 0) {
+    if (m_mapped) {
+      std::memcpy(m_mapped + allocation.offset, data, bytes);
+    } else {
+      glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+      glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.offset, bytes, data);
+      glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+  }
+
+  m_offset += size;
+  m_peakUsage = std::max(m_peakUsage, m_offset);
+  return allocation;
+}
@@ -52,20 +52,29 @@ bool SceneGraphSystem::startup() {
 
                   ImGui::Checkbox("Visible", &drawable->visible);
                   ImGui::Separator();
-                  ImGui::ColorEdit3("Diffuse Color", (float*)&drawable->material.diffuseColor);
-                  m_renderer->showTextureChooser(drawable->material.diffuseTexture, entityName + std::string("diff"));
 
-                  ImGui::ColorEdit3("Specular Color", (float*)&drawable->material.specularColor);
-                  m_renderer->showTextureChooser(drawable->material.specularTexture, entityName + std::string("spec"));
+                  // Edited on a copy, so the material is only uploaded again if something changed
+                  auto material = m_renderer->getMaterial(drawable->material);
+                  bool changed = false;
+                  ImGui::Text("Material %d", (int)drawable->material);
+                  changed |= ImGui::ColorEdit3("Diffuse Color", (float*)&material.diffuseColor);
+                  changed |= m_renderer->showTextureChooser(material.diffuseTexture, entityName + std::string("diff"));
 
-                  ImGui::ColorEdit3("Emissive Color", (float*)&drawable->material.emissiveColor);
-                  m_renderer->showTextureChooser(drawable->material.emissiveTexture, entityName + std::string("emmi"));
+                  changed |= ImGui::ColorEdit3("Specular Color", (float*)&material.specularColor);
+                  changed |= m_renderer->showTextureChooser(material.specularTexture, entityName + std::string("spec"));
 
-                  ImGui::SliderFloat("IOR", (float*)&drawable->material.eta, 1.0f, 6.0f);
-                  ImGui::SliderFloat("Refractiveness", (float*)&drawable->material.refractiveness, 0.0f, 1.0f);
-                  ImGui::SliderFloat("Roughness", (float*)&drawable->material.roughness, 0.0f, 1.0f);
+                  changed |= ImGui::ColorEdit3("Emissive Color", (float*)&material.emissiveColor);
+                  changed |= m_renderer->showTextureChooser(material.emissiveTexture, entityName + std::string("emmi"));
 
-                  m_renderer->showTextureChooser(drawable->material.normalsTexture, entityName + std::string("norm"));
+                  changed |= ImGui::SliderFloat("IOR", (float*)&material.eta, 1.0f, 6.0f);
+                  changed |= ImGui::SliderFloat("Refractiveness", (float*)&material.refractiveness, 0.0f, 1.0f);
+                  changed |= ImGui::SliderFloat("Roughness", (float*)&material.roughness, 0.0f, 1.0f);
+
+                  changed |= m_renderer->showTextureChooser(material.normalsTexture, entityName + std::string("norm"));
+
+                  if (changed) {
+                      m_renderer->setMaterial(drawable->material, material);
+                  }
 
                   ImGui::TreePop();
               }
@@ -157,26 +166,17 @@ void SceneGraphSystem::prepareDraw(double interp) {
   auto drawableEntities =
       m_entityManager.entities_with_components<Drawable, Transform>();
 
-  auto cameras = m_entityManager.entities_with_components<Camera>();
-  std::vector<glm::dvec3> cams(m_renderer->getNumPasses());
-  for (auto e : cameras) {
-    auto passIndex = e.component<Camera>()->renderPassIndex;
-    if (passIndex < cams.size()) {
-      cams[passIndex] = e.component<Transform>()->thisGlobalTransform.pos;
-    }
-  }
-
+  // Submitted once, the renderer picks each pass' part of the scene by mask
   Drawable::Handle drawable;
   for (auto e : drawableEntities) {
     e.unpack<Drawable, Transform>(drawable, transform);
-    if (drawable->renderPassIndex >= cams.size())
-      continue;
 
     auto thisRenderTransform = interpolate(
         transform->lastGlobalTransform, transform->thisGlobalTransform, interp);
     if (drawable->visible) {
       m_renderer->submit({drawable->material, drawable->geometry,
-                          transform->lastRenderTransform, thisRenderTransform}, drawable->renderPassIndex);
+                          transform->lastRenderTransform, thisRenderTransform,
+                          e.id().id(), drawable->renderPassMask});
     }
     transform->lastRenderTransform = thisRenderTransform;
   }
@@ -195,8 +195,8 @@ void SceneGraphSystem::prepareDraw(double interp) {
 
     m_renderer->submit(LightData{light->color, light->size, light->dir,
                                  light->type, transform->lastGlobalTransform,
-                                 transform->thisGlobalTransform, lightVP},
-                       light->renderPassIndex);
+                                 transform->thisGlobalTransform, lightVP,
+                                 light->renderPassMask});
   }
 }
 
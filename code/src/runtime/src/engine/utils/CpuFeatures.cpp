@@ -0,0 +1,50 @@
+#include <engine/utils/CpuFeatures.hpp>
+
+#if ORION_X86 && defined(_MSC_VER)
+// Feature bit of cpuid leaf 1 ecx, or 0 if AVX is off or unsaved
+static bool cpuidAVXFeature(int bit) {
+  int info[4];
+  __cpuid(info, 1);
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  bool avx = (info[2] & (1 << 28)) != 0;
+
+  // The OS has to save the YMM registers too
+  return osxsave && avx && (_xgetbv(0) & 6) == 6 && (info[2] & (1 << bit)) != 0;
+}
+#endif
+
+bool cpuHasAVX() {
+#if ORION_X86
+#if defined(_MSC_VER)
+  static const bool supported = cpuidAVXFeature(28);
+#else
+  static const bool supported = __builtin_cpu_supports("avx");
+#endif
+  return supported;
+#else
+  return false;
+#endif
+}
+
+bool cpuHasAVX2() {
+#if ORION_X86
+#if defined(_MSC_VER)
+  static const bool supported = [] {
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+      return false;
+    }
+
+    __cpuidex(info, 7, 0);
+    bool avx2 = (info[1] & (1 << 5)) != 0;
+    return avx2 && cpuidAVXFeature(12); // FMA
+  }();
+#else
+  static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+  return supported;
+#else
+  return false;
+#endif
+}
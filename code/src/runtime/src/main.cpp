@@ -28,6 +28,7 @@
 #include <glow/objects/VertexArray.hh>
 
 #include <engine/graphics/BloomPostFX.hpp>
+#include <engine/graphics/CpuDenoiser.hpp>
 
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
@@ -39,8 +40,20 @@ glm::vec3 rotate(glm::vec3 vec, glm::mat4 mat) {
 
 int main(int argc, char *argv[]) {
 
+  // Denoising offline renders doesn't start any system, so it also works on
+  // machines without a GPU
+  if (argc >= 4 && argc <= 7 && std::string(argv[1]) == "--denoise") {
+    std::string guides[3];
+    for (int i = 4; i < argc; i++) {
+      guides[i - 4] = std::string(argv[i]) == "-" ? "" : argv[i];
+    }
+    return CpuDenoiser::denoiseFiles(argv[2], guides[0], guides[1], guides[2], argv[3]) ? 0 : -1;
+  }
+
   if (argc != 2) {
     std::cout << "Usage: <config file>" << std::endl;
+    std::cout << "       --denoise <color> <output> [<albedo> [<normal> [<depth>]]]" << std::endl;
+    std::cout << "       ('-' skips a guide)" << std::endl;
     return -1;
   }
 
@@ -106,15 +119,14 @@ int main(int argc, char *argv[]) {
   renderer.registerTexture(emissiveTex);
   renderer.registerTexture(normalTex);
 
-  Geometry teapotGeom = {glow::assimp::Importer().load("data/geometry/teapot.obj")};
-  Geometry testSceneGeom = {glow::assimp::Importer().load("data/geometry/test_scene.obj")};
-  Geometry teddyGeom = {glow::assimp::Importer().load("data/geometry/teddy.obj")};
-  Geometry coornellBoxGeom = {
-      glow::assimp::Importer().load("data/geometry/CornellBox-Original.obj")};
-  Geometry icosphereGeom = {glow::assimp::Importer().load("data/geometry/icosphere.obj")};
-  Geometry sphereGeom = { glow::assimp::Importer().load("data/geometry/sphere.obj") };
+  Geometry teapotGeom = Geometry::create(glow::assimp::Importer().load("data/geometry/teapot.obj"));
+  Geometry testSceneGeom = Geometry::create(glow::assimp::Importer().load("data/geometry/test_scene.obj"));
+  Geometry teddyGeom = Geometry::create(glow::assimp::Importer().load("data/geometry/teddy.obj"));
+  Geometry coornellBoxGeom = Geometry::create(glow::assimp::Importer().load("data/geometry/CornellBox-Original.obj"));
+  Geometry icosphereGeom = Geometry::create(glow::assimp::Importer().load("data/geometry/icosphere.obj"));
+  Geometry sphereGeom = Geometry::create(glow::assimp::Importer().load("data/geometry/sphere.obj"));
 
-  Material whiteMat = {
+  MaterialHandle whiteMat = renderer.registerMaterial({
       {0.8f, 0.8f, 0.8f},
       1.0f,
       {20.0f, 20.0f, 20.0f},
@@ -125,15 +137,15 @@ int main(int argc, char *argv[]) {
       nullptr,
       vciLogoTex,
       nullptr,
-  };
+  });
   Entity teapotCenter = sceneGraph.create();
   auto boxTrans = teapotCenter.assign<Transform>();
   teapotCenter.assign<Drawable>(testSceneGeom, whiteMat);
 
-  Material emissiveMat = {
-      { 1.0f, 1.0f, 1.0f }, 0.0f,{ 15.0f, 1.0f, 1.0f }, 0.0f,{ 0.0f, 0.0f, 0.0f }, 1.0 };
+  MaterialHandle emissiveMat = renderer.registerMaterial({
+      { 1.0f, 1.0f, 1.0f }, 0.0f,{ 15.0f, 1.0f, 1.0f }, 0.0f,{ 0.0f, 0.0f, 0.0f }, 1.0 });
 
-  Material refractiveMat = {
+  MaterialHandle refractiveMat = renderer.registerMaterial({
       { 0.0f, 0.0f, 0.0f },
       1.0f,
       { 0.0f, 0.0f, 0.0f },
@@ -144,7 +156,7 @@ int main(int argc, char *argv[]) {
       nullptr,
       nullptr,
       nullptr,
-  };
+  });
 
   auto modTest = audio.createSound("spacedeb.mod", SoundMode::MODE_2D);
   
@@ -175,7 +187,7 @@ int main(int argc, char *argv[]) {
   std::vector<Transform::Handle> barTransforms;
   std::vector<Entity> barEntities;
 
-  Material cubeMat = {
+  MaterialHandle cubeMat = renderer.registerMaterial({
       { 0.8f, 0.8f, 0.8f },
       1.0f,
       { 0.0f, 0.0f, 0.0f },
@@ -186,9 +198,9 @@ int main(int argc, char *argv[]) {
       nullptr,
       nullptr,
       normalTex,
-  };
+  });
 
-  Geometry cubeGeom = { glow::assimp::Importer().load("data/geometry/cube.obj") };
+  Geometry cubeGeom = Geometry::create(glow::assimp::Importer().load("data/geometry/cube.obj"));
 
   auto cubeEntity = sceneGraph.create();
   auto cubeTransform = cubeEntity.assign<Transform>();
@@ -327,7 +339,7 @@ int main(int argc, char *argv[]) {
         total += data;
     }
 
-    sphereDrawable->material.emissiveColor = glm::vec3(total) * 0.1f;
+    renderer.editMaterial(sphereDrawable->material).emissiveColor = glm::vec3(total) * 0.1f;
 
   }); 
 
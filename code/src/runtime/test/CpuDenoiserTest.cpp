@@ -0,0 +1,129 @@
+#include <engine/graphics/CpuDenoiser.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Denoises a noisy image with a hard edge in memory, once with AVX2 and
+// once with the scalar filter, and checks that both agree, reduce the noise
+// and keep the edge.
+
+static const int WIDTH = 133; // not a multiple of eight, so spans have a remainder
+static const int HEIGHT = 80;
+static const int EDGE = 61;
+
+static int failures = 0;
+
+static void check(bool condition, const char* what) {
+  if (!condition) {
+    std::cerr << "FAILED: " << what << std::endl;
+    failures++;
+  }
+}
+
+// Variance of the red channel over the columns [x0, x1)
+static float variance(const std::vector<float>& image, int x0, int x1) {
+  double sum = 0, sumSquares = 0;
+  int count = 0;
+  for (int y = 0; y < HEIGHT; y++) {
+    for (int x = x0; x < x1; x++) {
+      double value = image[((size_t)y * WIDTH + x) * 3];
+      sum += value;
+      sumSquares += value * value;
+      count++;
+    }
+  }
+  double mean = sum / count;
+  return (float)(sumSquares / count - mean * mean);
+}
+
+static float mean(const std::vector<float>& image, int x0, int x1) {
+  double sum = 0;
+  for (int y = 0; y < HEIGHT; y++) {
+    for (int x = x0; x < x1; x++) {
+      sum += image[((size_t)y * WIDTH + x) * 3];
+    }
+  }
+  return (float)(sum / ((x1 - x0) * HEIGHT));
+}
+
+int main() {
+  size_t pixelCount = (size_t)WIDTH * HEIGHT;
+  std::vector<float> color(pixelCount * 3);
+  std::vector<float> normal(pixelCount * 3);
+  std::vector<float> depth(pixelCount);
+
+  // A dark and a bright wall meeting at a corner
+  std::mt19937 rng(1234);
+  std::normal_distribution<float> noise(0.0f, 0.1f);
+  for (int y = 0; y < HEIGHT; y++) {
+    for (int x = 0; x < WIDTH; x++) {
+      size_t i = (size_t)y * WIDTH + x;
+      bool left = x < EDGE;
+      for (int c = 0; c < 3; c++) {
+        color[i * 3 + c] = (left ? 0.2f : 1.0f) + noise(rng);
+      }
+      normal[i * 3 + 0] = left ? 1.0f : 0.0f;
+      normal[i * 3 + 1] = 0.0f;
+      normal[i * 3 + 2] = left ? 0.0f : 1.0f;
+      depth[i] = left ? 2.0f : 3.0f;
+    }
+  }
+
+  DenoiseInput input = { WIDTH, HEIGHT, color.data(), nullptr, normal.data(), depth.data() };
+
+  DenoiseSettings scalarSettings;
+  scalarSettings.allowSimd = false;
+  scalarSettings.tileSize = 32;
+  std::vector<float> scalar(pixelCount * 3);
+  CpuDenoiser::denoise(input, scalar.data(), scalarSettings);
+
+  DenoiseSettings simdSettings = scalarSettings;
+  simdSettings.allowSimd = true;
+  std::vector<float> simd(pixelCount * 3);
+  CpuDenoiser::denoise(input, simd.data(), simdSettings);
+
+  if (!CpuDenoiser::hasAVX2()) {
+    std::cout << "No AVX2, both runs used the scalar filter" << std::endl;
+  }
+
+  float maxDifference = 0;
+  for (size_t i = 0; i < pixelCount * 3; i++) {
+    maxDifference = std::max(maxDifference, std::abs(simd[i] - scalar[i]));
+  }
+  std::cout << "Largest difference between SIMD and scalar: " << maxDifference << std::endl;
+  check(maxDifference < 1e-3f, "SIMD and scalar results agree");
+
+  // Tiles are independent, so the thread count doesn't change the result
+  DenoiseSettings singleThreadSettings = scalarSettings;
+  singleThreadSettings.threadCount = 1;
+  std::vector<float> singleThread(pixelCount * 3);
+  CpuDenoiser::denoise(input, singleThread.data(), singleThreadSettings);
+  check(singleThread == scalar, "single threaded result matches");
+
+  for (auto* result : { &scalar, &simd }) {
+    for (float value : *result) {
+      check(std::isfinite(value), "output is finite");
+      if (!std::isfinite(value)) {
+        break;
+      }
+    }
+
+    check(variance(*result, 0, EDGE - 2) < variance(color, 0, EDGE - 2) * 0.25f, "noise is reduced left of the edge");
+    check(variance(*result, EDGE + 2, WIDTH) < variance(color, EDGE + 2, WIDTH) * 0.25f,
+          "noise is reduced right of the edge");
+
+    // The guides stop the filter from blurring across the corner
+    check(std::abs(mean(*result, EDGE - 2, EDGE) - 0.2f) < 0.05f, "dark side of the edge is kept");
+    check(std::abs(mean(*result, EDGE, EDGE + 2) - 1.0f) < 0.05f, "bright side of the edge is kept");
+  }
+
+  if (failures > 0) {
+    std::cerr << failures << " checks failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All checks passed" << std::endl;
+  return 0;
+}
@@ -0,0 +1,95 @@
+#include <engine/graphics/GpuProfiler.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Runs frames with different sets of scopes through a profiler without a GL
+// context and checks that every scope ends up at the stage of its path, no
+// matter which scopes the frames before it had.
+
+static int failures = 0;
+
+static void check(bool condition, const std::string& what) {
+  if (!condition) {
+    std::cerr << "FAILED: " << what << std::endl;
+    failures++;
+  }
+}
+
+static void runFrame(GpuProfiler& profiler, bool sortPrimitives, int passCount) {
+  profiler.beginFrame();
+  GpuProfilerScope frame(profiler, "Frame");
+  {
+    GpuProfilerScope prepare(profiler, "Prepare Scene");
+    { GpuProfilerScope copy(profiler, "Copy Primitives"); }
+    if (sortPrimitives) {
+      GpuProfilerScope sort(profiler, "Sort Primitives");
+    }
+  }
+  for (int i = 0; i < passCount; i++) {
+    GpuProfilerScope pass(profiler, "Pass " + std::to_string(i));
+    { GpuProfilerScope raster(profiler, "Raster"); }
+    { GpuProfilerScope trace(profiler, "Trace"); }
+    { GpuProfilerScope trace(profiler, "Trace"); }
+  }
+  { GpuProfilerScope blit(profiler, "Blit"); }
+}
+
+static std::vector<std::string> stagePaths(const GpuProfiler& profiler) {
+  std::vector<std::string> paths;
+  for (size_t i = 0; i < profiler.stageCount(); i++) {
+    paths.push_back(profiler.stagePath(i));
+  }
+  std::sort(paths.begin(), paths.end());
+  return paths;
+}
+
+int main() {
+  std::vector<std::string> expected = {
+    "Frame",
+    "Frame/Blit",
+    "Frame/Pass 0",
+    "Frame/Pass 0/Raster",
+    "Frame/Pass 0/Trace",
+    "Frame/Pass 1",
+    "Frame/Pass 1/Raster",
+    "Frame/Pass 1/Trace",
+    "Frame/Prepare Scene",
+    "Frame/Prepare Scene/Copy Primitives",
+    "Frame/Prepare Scene/Sort Primitives",
+  };
+
+  GpuProfiler profiler;
+
+  // The first frame creates the stages in scope order, the later ones skip
+  // the sort and have more scopes than there are stages
+  runFrame(profiler, true, 1);
+  profiler.endFrame();
+  runFrame(profiler, false, 2);
+  profiler.endFrame();
+  runFrame(profiler, false, 2);
+  profiler.endFrame();
+
+  auto paths = stagePaths(profiler);
+  check(paths == expected, "stage paths match the scopes");
+  if (paths != expected) {
+    for (auto& path : paths) {
+      std::cerr << "  " << path << std::endl;
+    }
+  }
+
+  // Scopes begun outside of a frame are ignored
+  size_t stageCount = profiler.stageCount();
+  profiler.begin("Outside");
+  profiler.end();
+  check(profiler.stageCount() == stageCount, "scopes outside of a frame add no stage");
+
+  if (failures > 0) {
+    std::cerr << failures << " checks failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All checks passed" << std::endl;
+  return 0;
+}
@@ -0,0 +1,61 @@
+#include <engine/graphics/ShaderSource.hpp>
+
+#include <iostream>
+#include <string>
+
+// Expands the tracing kernel the way RendererSystem compiles it and checks
+// that every include was pasted in and no #include is left for the driver.
+
+static int failures = 0;
+
+static bool hasDirective(const std::string& source, const std::string& directive) {
+  return source.compare(0, directive.size(), directive) == 0 || source.find("\n" + directive) != std::string::npos;
+}
+
+static void check(bool condition, const std::string& what) {
+  if (!condition) {
+    std::cerr << "FAILED: " << what << std::endl;
+    failures++;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  if (argc != 2) {
+    std::cerr << "Usage: <shader directory>" << std::endl;
+    return 1;
+  }
+  std::string shaderPath = argv[1];
+
+  std::string source = expandShaderIncludes(shaderPath + "/compute/RaycastCompute.glsl");
+  check(!source.empty(), "the tracing kernel can be read");
+  check(!hasDirective(source, "#include"), "no #include is left");
+
+  // One symbol of each file RaycastCompute.glsl includes
+  const char* symbols[] = {
+    "bool intersectPrimitive(",       // PrimitiveCommon.glsl
+    "uint wang_hash(",                // Random.glsl
+    "int radianceCacheFind(",         // RadianceCache.glsl
+    "bool isTracedPixel(",            // Interleave.glsl
+    "buffer SampleAllocationBuffer",  // SampleAllocation.glsl
+    "buffer IrradianceVolumeBuffer",  // IrradianceVolume.glsl
+    "vec4 sampleMaterialTexture(",    // TextureTable.glsl
+  };
+  for (auto symbol : symbols) {
+    check(source.find(symbol) != std::string::npos, std::string("the kernel contains ") + symbol);
+    check(source.find(symbol) == source.rfind(symbol), std::string("the kernel contains ") + symbol + " once");
+  }
+
+  // Nothing may come before the #version and the extensions RendererSystem
+  // puts in front
+  check(!hasDirective(source, "#version"), "the kernel has no #version of its own");
+  check(!hasDirective(source, "#extension"), "the kernel has no #extension of its own");
+
+  check(expandShaderIncludes(shaderPath + "/compute/Missing.glsl").empty(), "missing files expand to nothing");
+
+  if (failures > 0) {
+    std::cerr << failures << " checks failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All checks passed" << std::endl;
+  return 0;
+}